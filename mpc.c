@@ -37,21 +37,18 @@ static mpc_state_t mpc_state_new(void) {
 ** The cursor can jump around at will making
 ** backtracking easy.
 **
-** The second is a File which is also somewhat
-** easy. The contents are never loaded into
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** Files and Pipes are read in blocks into a
+** buffer which starts at `buffer_start` in the
+** input. Before another block is read anything
+** behind the oldest mark (or the cursor, if
+** nothing is marked) is dropped from the front,
+** so the buffer only ever holds what we could
+** still be asked to seek back to.
 **
-** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
-**
-** This means that if we are requested to seek
-** back we can simply start reading from the
-** buffer instead of the input.
+** Neither is ever seeked while parsing, so both
+** work the same way. Pipes are read at most a
+** line at a time so that interactive input is
+** not held up waiting for a full block.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -69,22 +66,52 @@ enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+enum {
+  MPC_INPUT_BLOCK = 65536
+};
+
+/*
+** Temporary values are allocated from fixed size
+** blocks. The first chunk of blocks is part of the
+** input and more are added in doubling chunks if
+** it runs out, so only larger values and reallocs
+** go to malloc. Freed blocks go on a free list and
+** all the chunks are released with the input. The
+** chunks keep doubling so the list that mpc_free
+** searches stays short on deeply nested input.
+**
+** Compiling with MPC_MEM_STATS prints how many
+** allocations fell back to malloc for each input.
+*/
+
 enum {
   MPC_INPUT_MEM_NUM = 512
 };
 
-typedef struct {
+typedef union mpc_mem_t {
+  union mpc_mem_t *next;
   char mem[64];
 } mpc_mem_t;
 
+typedef struct mpc_mem_chunk_t {
+  struct mpc_mem_chunk_t *next;
+  size_t num;
+  mpc_mem_t *mem;
+} mpc_mem_chunk_t;
+
 typedef struct {
 
   int type;
   char *filename;
   mpc_state_t state;
 
-  char *string;
+  const char *string;
+  long length;
   char *buffer;
+  long buffer_start;
+  long buffer_num;
+  long buffer_slots;
+  int buffer_end;
   FILE *file;
 
   int suppress;
@@ -96,10 +123,21 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
+  int diagnose;
+  int span;
+
+  mpc_mem_t *mem_free;
+  mpc_mem_t *mem_top;
+  mpc_mem_t *mem_end;
+  mpc_mem_chunk_t *mem_chunks;
+  long mem_allocs;
+  long mem_fallbacks;
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
+  struct mpc_memo_t *memo;
+  long memo_bytes;
+  struct mpc_ast_arena_t *arena;
+
 } mpc_input_t;
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
@@ -112,9 +150,13 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = strlen(string);
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->buffer_end = 0;
   i->file = NULL;
 
   i->suppress = 0;
@@ -125,8 +167,19 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->diagnose = 0;
+  i->span = 0;
+
+  i->mem_free = NULL;
+  i->mem_top = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
+  i->mem_allocs = 0;
+  i->mem_fallbacks = 0;
+
+  i->memo = NULL;
+  i->memo_bytes = 0;
+  i->arena = NULL;
 
   return i;
 }
@@ -141,10 +194,13 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->state = mpc_state_new();
 
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->buffer_end = 0;
   i->file = NULL;
 
   i->suppress = 0;
@@ -155,8 +211,19 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->diagnose = 0;
+  i->span = 0;
+
+  i->mem_free = NULL;
+  i->mem_top = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
+  i->mem_allocs = 0;
+  i->mem_fallbacks = 0;
+
+  i->memo = NULL;
+  i->memo_bytes = 0;
+  i->arena = NULL;
 
   return i;
 
@@ -173,7 +240,12 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->buffer_end = 0;
   i->file = pipe;
 
   i->suppress = 0;
@@ -184,8 +256,19 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->diagnose = 0;
+  i->span = 0;
+
+  i->mem_free = NULL;
+  i->mem_top = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
+  i->mem_allocs = 0;
+  i->mem_fallbacks = 0;
+
+  i->memo = NULL;
+  i->memo_bytes = 0;
+  i->arena = NULL;
 
   return i;
 
@@ -201,7 +284,12 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->buffer_end = 0;
   i->file = file;
 
   i->suppress = 0;
@@ -212,18 +300,55 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->diagnose = 0;
+  i->span = 0;
+
+  i->mem_free = NULL;
+  i->mem_top = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
+  i->mem_allocs = 0;
+  i->mem_fallbacks = 0;
+
+  i->memo = NULL;
+  i->memo_bytes = 0;
+  i->arena = NULL;
 
   return i;
 }
 
 static void mpc_input_delete(mpc_input_t *i) {
 
+  mpc_mem_chunk_t *c;
+
+#ifdef MPC_MEM_STATS
+  size_t blocks = MPC_INPUT_MEM_NUM;
+  for (c = i->mem_chunks; c; c = c->next) { blocks += c->num; }
+  fprintf(stderr, "%s: %ld allocations, %ld (%.1f%%) from malloc, %lu blocks\n", i->filename,
+    i->mem_allocs, i->mem_fallbacks,
+    i->mem_allocs ? 100.0 * i->mem_fallbacks / i->mem_allocs : 0.0,
+    (unsigned long)blocks);
+#endif
+
+  while (i->mem_chunks) {
+    c = i->mem_chunks;
+    i->mem_chunks = c->next;
+    free(c);
+  }
+
   free(i->filename);
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  /* Give back what was read ahead but not consumed */
+  if (i->type == MPC_INPUT_FILE) {
+    fseek(i->file, i->state.pos - (i->buffer_start + i->buffer_num), SEEK_CUR);
+  }
+
+  /* C only promises one byte of pushback, which is all a pipe has read ahead unless the parser backtracked out of more */
+  if (i->type == MPC_INPUT_PIPE && i->state.pos == i->buffer_start + i->buffer_num - 1) {
+    ungetc(i->buffer[i->buffer_num - 1], i->file);
+  }
+
+  free(i->buffer);
 
   free(i->marks);
   free(i->lasts);
@@ -231,29 +356,43 @@ static void mpc_input_delete(mpc_input_t *i) {
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  mpc_mem_chunk_t *c;
+  if ((mpc_mem_t*)p >= i->mem && (mpc_mem_t*)p < i->mem + MPC_INPUT_MEM_NUM) { return 1; }
+  for (c = i->mem_chunks; c; c = c->next) {
+    if ((mpc_mem_t*)p >= c->mem && (mpc_mem_t*)p < c->mem + c->num) { return 1; }
+  }
+  return 0;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
+  mpc_mem_t *p;
+  mpc_mem_chunk_t *c;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  i->mem_allocs++;
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (n > sizeof(mpc_mem_t)) {
+    i->mem_fallbacks++;
+    return malloc(n);
+  }
+
+  if (i->mem_free) {
+    p = i->mem_free;
+    i->mem_free = p->next;
+    return p;
+  }
+
+  if (i->mem_top == i->mem_end) {
+    n = i->mem_chunks ? i->mem_chunks->num * 2 : MPC_INPUT_MEM_NUM * 2;
+    c = malloc(sizeof(mpc_mem_chunk_t) + sizeof(mpc_mem_t) * n);
+    c->num = n;
+    c->mem = (mpc_mem_t*)(c + 1);
+    c->next = i->mem_chunks;
+    i->mem_chunks = c;
+    i->mem_top = c->mem;
+    i->mem_end = c->mem + c->num;
+  }
 
-  return malloc(n);
+  return i->mem_top++;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -263,10 +402,9 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  ((mpc_mem_t*)p)->next = i->mem_free;
+  i->mem_free = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -276,6 +414,7 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
 
   if (n > sizeof(mpc_mem_t)) {
+    i->mem_fallbacks++;
     q = malloc(n);
     memcpy(q, p, sizeof(mpc_mem_t));
     mpc_free(i, p);
@@ -294,6 +433,126 @@ static void *mpc_export(mpc_input_t *i, void *p) {
   return q;
 }
 
+/*
+** AST Arenas
+**
+** Rules of a grammar made with MPCA_LANG_ARENA build
+** their AST inside an arena that belongs to the parse.
+** Nodes, tags, contents and child arrays are all cut
+** from large blocks and nothing is freed on the way,
+** so deleting the root of the finished AST releases
+** all of it at once, while deleting any other node
+** of it does nothing. Nodes from outside the arena
+** that are added to it are deleted along with it.
+*/
+
+enum {
+  MPC_AST_ARENA_BLOCK = 4096,
+  MPC_AST_ARENA_BLOCK_MAX = 1048576
+};
+
+typedef union {
+  void *p;
+  long l;
+  double d;
+} mpc_ast_align_t;
+
+typedef struct mpc_ast_block_t {
+  struct mpc_ast_block_t *next;
+  size_t size;
+} mpc_ast_block_t;
+
+typedef struct mpc_ast_adopted_t {
+  struct mpc_ast_adopted_t *next;
+  mpc_ast_t *a;
+} mpc_ast_adopted_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_t *root;
+  char *top;
+  char *end;
+  mpc_ast_block_t *blocks;
+  mpc_ast_adopted_t *adopted;
+};
+
+static size_t mpc_ast_arena_round(size_t n) {
+  return (n + sizeof(mpc_ast_align_t) - 1) / sizeof(mpc_ast_align_t) * sizeof(mpc_ast_align_t);
+}
+
+static struct mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  struct mpc_ast_arena_t *m = malloc(sizeof(struct mpc_ast_arena_t));
+  m->root = NULL;
+  m->top = NULL;
+  m->end = NULL;
+  m->blocks = NULL;
+  m->adopted = NULL;
+  return m;
+}
+
+static void *mpc_ast_arena_alloc(struct mpc_ast_arena_t *m, size_t n) {
+
+  mpc_ast_block_t *b;
+  size_t size;
+  char *p;
+
+  n = mpc_ast_arena_round(n);
+
+  if ((size_t)(m->end - m->top) < n) {
+    size = m->blocks ? m->blocks->size * 2 : MPC_AST_ARENA_BLOCK;
+    size = size > MPC_AST_ARENA_BLOCK_MAX ? MPC_AST_ARENA_BLOCK_MAX : size;
+    size = size < n ? n : size;
+    b = malloc(mpc_ast_arena_round(sizeof(mpc_ast_block_t)) + size);
+    b->next = m->blocks;
+    b->size = size;
+    m->blocks = b;
+    m->top = (char*)b + mpc_ast_arena_round(sizeof(mpc_ast_block_t));
+    m->end = m->top + size;
+  }
+
+  p = m->top;
+  m->top += n;
+  return p;
+}
+
+static char *mpc_ast_arena_strdup(struct mpc_ast_arena_t *m, const char *s) {
+  char *x = mpc_ast_arena_alloc(m, strlen(s) + 1);
+  strcpy(x, s);
+  return x;
+}
+
+static int mpc_ast_arena_owns(struct mpc_ast_arena_t *m, void *p) {
+  mpc_ast_block_t *b;
+  for (b = m->blocks; b; b = b->next) {
+    if ((char*)p > (char*)b && (char*)p < (char*)b + mpc_ast_arena_round(sizeof(mpc_ast_block_t)) + b->size) { return 1; }
+  }
+  return 0;
+}
+
+/* Hands a node from outside the arena over to it */
+static void mpc_ast_arena_adopt(struct mpc_ast_arena_t *m, mpc_ast_t *a) {
+  mpc_ast_adopted_t *d = mpc_ast_arena_alloc(m, sizeof(mpc_ast_adopted_t));
+  d->a = a;
+  d->next = m->adopted;
+  m->adopted = d;
+}
+
+static void mpc_ast_arena_delete(struct mpc_ast_arena_t *m) {
+
+  mpc_ast_block_t *b;
+  mpc_ast_adopted_t *d;
+
+  m->root = NULL;
+  for (d = m->adopted; d; d = d->next) { mpc_ast_delete(d->a); }
+
+  while (m->blocks) {
+    b = m->blocks;
+    m->blocks = b->next;
+    free(b);
+  }
+
+  free(m);
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -315,14 +574,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -337,14 +591,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -354,80 +600,63 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
+/* Reads until the buffer holds the current position. Returns zero at the end */
+static int mpc_input_buffer_fill(mpc_input_t *i) {
 
-static char mpc_input_getc(mpc_input_t *i) {
+  long keep, n;
+  int c;
 
-  char c = '\0';
+  while (i->state.pos >= i->buffer_start + i->buffer_num) {
 
-  switch (i->type) {
+    if (i->buffer_end) { return 0; }
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
+    keep = i->marks_num > 0 && i->marks[0].pos < i->state.pos ? i->marks[0].pos : i->state.pos;
+    if (keep > i->buffer_start + i->buffer_num) { keep = i->buffer_start + i->buffer_num; }
+    if (keep > i->buffer_start) {
+      memmove(i->buffer, i->buffer + (keep - i->buffer_start), i->buffer_num - (keep - i->buffer_start));
+      i->buffer_num -= keep - i->buffer_start;
+      i->buffer_start = keep;
+    }
 
-      if (!i->buffer) { c = getc(i->file); return c; }
+    if (i->buffer_num + MPC_INPUT_BLOCK > i->buffer_slots) {
+      i->buffer_slots = i->buffer_num + i->buffer_num / 2 + MPC_INPUT_BLOCK;
+      i->buffer = realloc(i->buffer, i->buffer_slots);
+    }
 
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    if (i->type == MPC_INPUT_FILE) {
+      n = fread(i->buffer + i->buffer_num, 1, MPC_INPUT_BLOCK, i->file);
+    } else {
+      /* Pipes are read a byte at a time, so no more is taken from them than is looked at, nulls are kept as data */
+      c = getc(i->file);
+      n = c != EOF;
+      if (n) { i->buffer[i->buffer_num] = (char)c; }
+    }
 
-    default: return c;
+    if (n == 0) { i->buffer_end = 1; }
+    i->buffer_num += n;
   }
-}
-
-static char mpc_input_peekc(mpc_input_t *i) {
-
-  char c = '\0';
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
 
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
-
-    case MPC_INPUT_PIPE:
+  return 1;
+}
 
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+static char mpc_input_buffer_at(mpc_input_t *i) {
+  return mpc_input_buffer_fill(i) ? i->buffer[i->state.pos - i->buffer_start] : '\0';
+}
 
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+/* Strings are read in place and end at a null or their length */
+static char mpc_input_string_at(mpc_input_t *i) {
+  return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
+}
 
-    default: return c;
-  }
+static char mpc_input_getc(mpc_input_t *i) {
+  return i->type == MPC_INPUT_STRING ? mpc_input_string_at(i) : mpc_input_buffer_at(i);
+}
 
+static char mpc_input_peekc(mpc_input_t *i) {
+  return i->type == MPC_INPUT_STRING ? mpc_input_string_at(i) : mpc_input_buffer_at(i);
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
@@ -435,34 +664,12 @@ static int mpc_input_terminated(mpc_input_t *i) {
 }
 
 static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: { break; }
-  }
+  (void) i; (void) c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -481,6 +688,16 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   return 1;
 }
 
+/*
+** Character classes are tested with a bit per
+** character rather than searching their string.
+*/
+
+typedef unsigned char mpc_charset_t[32];
+
+static void mpc_charset_add(mpc_charset_t s, int c) { s[c >> 3] |= (unsigned char)(1 << (c & 7)); }
+static int mpc_charset_has(const mpc_charset_t s, int c) { return (s[c >> 3] >> (c & 7)) & 1; }
+
 static int mpc_input_any(mpc_input_t *i, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
@@ -502,18 +719,11 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
-  char x;
-  if (mpc_input_terminated(i)) { return 0; }
-  x = mpc_input_getc(i);
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
-}
-
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_charset(mpc_input_t *i, const mpc_charset_t s, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return mpc_charset_has(s, (unsigned char)x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -537,8 +747,10 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
 
-  *o = mpc_malloc(i, strlen(c) + 1);
-  strcpy(*o, c);
+  if (o) {
+    *o = mpc_malloc(i, strlen(c) + 1);
+    strcpy(*o, c);
+  }
   return 1;
 }
 
@@ -918,7 +1130,10 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_EOI        = 28,
+
+  MPC_TYPE_DFA        = 29,
+  MPC_TYPE_CHARSET    = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -929,6 +1144,7 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; mpc_charset_t set; } mpc_pdata_oneof_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_t f; char *e; } mpc_pdata_check_t;
@@ -936,8 +1152,10 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; ch
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_charset_t *first; struct mpc_predict_group_t *group; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; int n; unsigned char *table; char *accept; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_charset_t set; } mpc_pdata_charset_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -948,6 +1166,7 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_oneof_t oneof;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_check_t check;
@@ -957,6 +1176,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_charset_t charset;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -964,6 +1185,15 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  char memo;
+  char arena;
+  char tag_ids;
+  char lazy;
+  char predict;
+  char span;
+  int tag_id;
+  int groups_num;
+  struct mpc_predict_group_t **groups;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -978,11 +1208,16 @@ static mpc_val_t *mpcf_input_trd_free(mpc_input_t *i, int n, mpc_val_t **xs) { r
 
 static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   int j;
-  size_t l = 0;
+  size_t l = 0, k;
   if (n == 0) { return mpc_calloc(i, 1, 1); }
   for (j = 0; j < n; j++) { l += strlen(xs[j]); }
+  k = strlen(xs[0]);
   xs[0] = mpc_realloc(i, xs[0], l + 1);
-  for (j = 1; j < n; j++) { strcat(xs[0], xs[j]); mpc_free(i, xs[j]); }
+  for (j = 1; j < n; j++) {
+    strcpy((char*)xs[0] + k, xs[j]);
+    k += strlen(xs[j]);
+    mpc_free(i, xs[j]);
+  }
   return xs[0];
 }
 
@@ -997,6 +1232,7 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
 
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
+  if (i->span)             { return NULL; }
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
   if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
   if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
@@ -1015,8 +1251,10 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
   return NULL;
 }
 
+static mpc_ast_t *mpc_ast_new_in(struct mpc_ast_arena_t *m, const char *tag, const char *contents);
+
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = mpc_ast_new_in(i->arena, "", c);
   mpc_free(i, c);
   return a;
 }
@@ -1036,289 +1274,731 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
-enum {
-  MPC_PARSE_STACK_MIN = 4
-};
+/*
+** Runs a compiled regex over a string input in
+** one loop, returning the longest match. Only
+** used where that is known to be the same as
+** what the combinators in `x` would match.
+*/
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+static int mpc_input_dfa(mpc_input_t *i, mpc_pdata_dfa_t *d, char **o) {
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+  const unsigned char *s = (const unsigned char*)i->string + i->state.pos;
+  long j, n = i->length - i->state.pos, end = d->accept[1] ? 0 : -1;
+  int q = 1;
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+  for (j = 0; j < n && s[j]; j++) {
+    q = d->table[q * 256 + s[j]];
+    if (q == 0) { break; }
+    if (d->accept[q]) { end = j + 1; }
+  }
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  if (end < 0) { return 0; }
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  for (j = 0; j < end; j++) {
+    i->state.col++;
+    if (s[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
   }
+  if (end > 0) { i->last = s[end-1]; }
+  i->state.pos += end;
 
-  switch (p->type) {
+  if (o) {
+    *o = mpc_malloc(i, end + 1);
+    memcpy(*o, s, end);
+    (*o)[end] = '\0';
+  }
+  return 1;
+}
 
-    /* Basic Parsers */
+/*
+** Packrat Memoization
+**
+** Rules of a grammar made with MPCA_LANG_PACKRAT
+** remember their result at each position, so that
+** alternatives which start with the same rule don't
+** parse it again after every rewind.
+**
+** Results are only stored the second time a rule is
+** tried at a position, which keeps the cost down for
+** grammars that rarely backtrack while still making
+** the bad cases linear. A stored AST isn't copied but
+** shared, counting the extra holders in `shared`, and
+** a node is only copied if it is changed while shared.
+** The table has a fixed number of slots and a new
+** position simply replaces what was in its slot. The
+** errors it copies are limited to `MPC_MEMO_BYTES`,
+** past which results are no longer stored.
+*/
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+enum {
+  MPC_MEMO_NUM = 4096,
+  MPC_MEMO_BYTES = 16 * 1024 * 1024
+};
 
-    /* Other parsers */
+typedef struct mpc_memo_t {
+  mpc_parser_t *p;
+  long pos;
+  int flags;
+  int stored;
+  int x;
+  mpc_ast_t *output;
+  mpc_err_t *error;
+  mpc_err_t *errors;
+  long bytes;
+  mpc_state_t state;
+  char last;
+} mpc_memo_t;
 
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a);
+static mpc_ast_t *mpc_ast_unshare_all(mpc_ast_t *a);
 
-    /* Application Parsers */
+/* Size of the copy `mpc_err_copy` makes */
+static long mpc_err_size(mpc_err_t *x) {
+  int j;
+  long n;
+  if (x == NULL) { return 0; }
+  n = sizeof(mpc_err_t) + strlen(x->filename) + 1 + sizeof(char*) * x->expected_num;
+  if (x->failure) { n += strlen(x->failure) + 1; }
+  for (j = 0; j < x->expected_num; j++) { n += strlen(x->expected[j]) + 1; }
+  return n;
+}
 
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  *y = *x;
+  y->filename = mpc_malloc(i, strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  return y;
+}
 
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
+static void mpc_memo_clear(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->stored) {
+    if (m->output) { mpc_ast_delete(m->output); }
+    if (m->error) { mpc_err_delete_internal(i, m->error); }
+    if (m->errors) { mpc_err_delete_internal(i, m->errors); }
+    i->memo_bytes -= m->bytes;
+  }
+  m->p = NULL;
+  m->stored = 0;
+}
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+static void mpc_input_memo_delete(mpc_input_t *i) {
+  int j;
+  if (i->memo == NULL) { return; }
+  for (j = 0; j < MPC_MEMO_NUM; j++) { mpc_memo_clear(i, &i->memo[j]); }
+  free(i->memo);
+  i->memo = NULL;
+  i->memo_bytes = 0;
+}
 
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+static int mpc_memo_flags(mpc_input_t *i) {
+  return (i->backtrack > 0) | ((i->suppress > 0) << 1);
+}
 
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
+/*
+** The parser is run as a loop over an explicit stack
+** of frames rather than by recursion, so how deeply
+** the input can nest is limited only by memory. Each
+** frame is one parser and how far it has got, and it
+** writes its output or error into a slot on a second
+** stack of results, given to it by its parent.
+*/
 
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
+enum {
+  MPC_PARSE_STACK_MIN = 64
+};
 
-    /* Optional Parsers */
+typedef struct {
+  mpc_parser_t *p;
+  int r;
+  int e;
+  int base;
+  int j;
+  long pos;
+  long span;
+  mpc_memo_t *m;
+  mpc_err_t *errors;
+} mpc_frame_t;
 
-    /* TODO: Update Not Error Message */
+/* Replays a stored result, or otherwise notes what the frame should do */
+static int mpc_memo_enter(mpc_input_t *i, mpc_frame_t *f, mpc_result_t *r, mpc_err_t **e, int *x) {
 
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+  int flags = mpc_memo_flags(i);
+  mpc_memo_t *m;
 
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+  if (i->memo == NULL) { i->memo = calloc(MPC_MEMO_NUM, sizeof(mpc_memo_t)); }
+  if (i->memo == NULL) { return 0; }
 
-    /* Repeat Parsers */
+  m = &i->memo[(((size_t)f->p >> 4) * 31 + (size_t)i->state.pos) % MPC_MEMO_NUM];
 
-    case MPC_TYPE_MANY:
+  /* First try here, just remember it was tried */
+  if (m->p != f->p || m->pos != i->state.pos || m->flags != flags) {
+    mpc_memo_clear(i, m);
+    m->p = f->p;
+    m->pos = i->state.pos;
+    m->flags = flags;
+    return 0;
+  }
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+  if (m->stored) {
+    i->state = m->state;
+    i->last = m->last;
+    *e = mpc_err_merge(i, *e, mpc_err_copy(i, m->errors));
+    if (m->x) {
+      r->output = mpc_ast_share(m->output);
+    } else {
+      r->error = mpc_err_copy(i, m->error);
+    }
+    *x = m->x;
+    return 1;
+  }
 
-      *e = mpc_err_merge(i, *e, results[j].error);
+  /* Second try, collect its errors separately so they can be stored */
+  f->m = m;
+  f->pos = i->state.pos;
+  f->errors = NULL;
+  return 0;
+}
 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+static void mpc_memo_store(mpc_input_t *i, mpc_frame_t *f, mpc_result_t *r, int x) {
 
-    case MPC_TYPE_MANY1:
+  /* The slot may have been reused by a rule nested inside this one */
+  mpc_memo_t *m = f->m;
+  long bytes = mpc_err_size(x ? NULL : r->error) + mpc_err_size(f->errors);
+  mpc_memo_clear(i, m);
+  m->p = f->p;
+  m->pos = f->pos;
+  m->flags = mpc_memo_flags(i);
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+  if (i->memo_bytes + bytes > MPC_MEMO_BYTES) { return; }
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
+  m->stored = 1;
+  m->x = x;
+  m->output = x ? mpc_ast_share(r->output) : NULL;
+  m->error = x ? NULL : mpc_err_copy(i, r->error);
+  m->errors = mpc_err_copy(i, f->errors);
+  m->bytes = bytes;
+  i->memo_bytes += bytes;
+  m->state = i->state;
+  m->last = i->last;
+}
 
-        *e = mpc_err_merge(i, *e, results[j].error);
+/*
+** Prediction
+**
+** Grammars built by mpca_lang note for each `or`
+** which characters every alternative can start
+** with. Alternatives that can't start with the
+** next character are skipped. Like compiled
+** regexes this is only done on string inputs,
+** and a failing parse is parsed again trying
+** every alternative to give the same errors.
+**
+** The tables built together by one grammar are a
+** group, and each rule looked through to find them
+** keeps a list of the groups that did. Redefining
+** the rule makes just those groups stale, so the
+** tables of other grammars, which other threads may
+** be parsing with, are never touched. Deleting one
+** with mpc_cleanup doesn't, as any grammar using it
+** goes with it.
+*/
 
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+enum {
+  MPC_PREDICT_OPEN = 1
+};
 
-    case MPC_TYPE_COUNT:
+typedef struct mpc_predict_group_t {
+  int stale;
+  int refs;
+} mpc_predict_group_t;
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+static mpc_predict_group_t *mpc_predict_group_new(void) {
+  mpc_predict_group_t *g = malloc(sizeof(mpc_predict_group_t));
+  g->stale = 0;
+  g->refs = 1;
+  return g;
+}
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
+static void mpc_predict_group_release(mpc_predict_group_t *g) {
+  if (g && --g->refs == 0) { free(g); }
+}
+
+/* Lets go of the groups that looked through `p`, making them stale if `stale` is set */
+static void mpc_predict_forget(mpc_parser_t *p, int stale) {
+  int j;
+  for (j = 0; j < p->groups_num; j++) {
+    if (stale) { p->groups[j]->stale = 1; }
+    mpc_predict_group_release(p->groups[j]);
+  }
+  free(p->groups);
+  p->groups = NULL;
+  p->groups_num = 0;
+}
+
+static void mpc_or_first_delete(mpc_parser_t *p) {
+  free(p->data.or.first);
+  mpc_predict_group_release(p->data.or.group);
+  p->data.or.first = NULL;
+  p->data.or.group = NULL;
+}
+
+static int mpc_or_predicted(mpc_parser_t *p) {
+  return p->data.or.first != NULL && !p->data.or.group->stale;
+}
+
+static int mpc_or_predict(mpc_input_t *i, mpc_parser_t *p, int j) {
+
+  int c;
+
+  if (!mpc_or_predicted(p)
+  ||  i->type != MPC_INPUT_STRING || i->diagnose) { return j; }
+
+  c = (unsigned char)mpc_input_string_at(i);
+  while (j < p->data.or.n && !mpc_charset_has(p->data.or.first[j], c)) { j++; }
+
+  return j;
+}
+
+#define MPC_SUCCESS(x) r->output = x; return 1
+#define MPC_FAILURE(x) r->error = x; return 1
+#define MPC_PRIMITIVE(x) \
+  *t = x; \
+  if (*t) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+
+/*
+** Runs parsers that don't call any others, setting `t` to
+** whether they matched. Returns zero for other parsers.
+*/
+
+static int mpc_parse_leaf(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, int *t) {
+
+  /* Inside a span nothing is output until the end */
+  char **o = (char**)&r->output;
+  if (i->span) { r->output = NULL; o = NULL; }
+
+  if (p->memo) { return 0; }
+
+  switch (p->type) {
+
+    /* Basic Parsers */
+
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, o));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, o));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, o));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_charset(i, p->data.oneof.set, o));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_charset(i, p->data.oneof.set, o));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, o));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, o));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
+    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+
+    /*
+    ** The combinators are still used in predictive mode, where
+    ** failed branches don't rewind, and when rebuilding errors.
+    */
+
+    case MPC_TYPE_DFA:
+      if (i->type != MPC_INPUT_STRING || i->backtrack < 1 || i->diagnose) { return 0; }
+      MPC_PRIMITIVE(mpc_input_dfa(i, &p->data.dfa, o));
+
+    /* A single character never needs to be given back, even in predictive mode */
+
+    case MPC_TYPE_CHARSET:
+      if (i->type != MPC_INPUT_STRING || i->diagnose) { return 0; }
+      MPC_PRIMITIVE(mpc_input_charset(i, p->data.charset.set, o));
+
+    /* Other parsers */
+
+    case MPC_TYPE_UNDEFINED: *t = 0; MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+    case MPC_TYPE_PASS:      *t = 1; MPC_SUCCESS(NULL);
+    case MPC_TYPE_FAIL:      *t = 0; MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+    case MPC_TYPE_LIFT:      *t = 1; MPC_SUCCESS(i->span ? NULL : p->data.lift.lf());
+    case MPC_TYPE_LIFT_VAL:  *t = 1; MPC_SUCCESS(p->data.lift.x);
+    case MPC_TYPE_STATE:     *t = 1; MPC_SUCCESS(mpc_input_state_copy(i));
+
+    default: return 0;
+  }
+
+}
+
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+
+/*
+** Parsers that call others push a frame for them and
+** are resumed with the result once it returns. Parsers
+** that don't are run straight away to save a frame.
+*/
+
+#define MPC_SUCCESS(x) r->output = x; t = 1; break
+#define MPC_FAILURE(x) r->error = x; t = 0; break
+
+#define MPC_STACK_GROW(xs, num, slots) \
+  if (num == slots) { slots *= 2; xs = realloc(xs, sizeof(*xs) * slots); }
+
+/* Where a frame's errors go. A frame storing its result in the memo table keeps its own */
+#define MPC_ERRORS_OF(n) ((n) == -1 ? -1 : frames[n].m ? (n) : frames[n].e)
+#define MPC_ERRORS_AT(n) ((n) == -1 ? e0 : &frames[n].errors)
+#define MPC_ERRORS MPC_ERRORS_AT(MPC_ERRORS_OF(frames_num-1))
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+#define MPC_CALL(x, r) call = x; call_r = r; continue
+#define MPC_CALL_NEXT(x) MPC_STACK_GROW(stack, stack_num, stack_slots); MPC_CALL(x, stack_num++)
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r0, mpc_err_t **e0) {
+
+  int k, t = 0;
+  int resume = 0;
+  int frames_num = 0, frames_slots = MPC_PARSE_STACK_MIN;
+  int stack_num = 1, stack_slots = MPC_PARSE_STACK_MIN;
+  int call_r = 0;
+  mpc_parser_t *call = p;
+  mpc_frame_t *f, *frames = malloc(sizeof(mpc_frame_t) * frames_slots);
+  mpc_result_t *r, *results, *stack = malloc(sizeof(mpc_result_t) * stack_slots);
+  mpc_err_t **e;
+
+  while (1) {
+
+    if (call) {
+      if (mpc_parse_leaf(i, call, &stack[call_r], &t)) {
+        resume = 1;
+        if (frames_num == 0) { break; }
       } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        MPC_STACK_GROW(frames, frames_num, frames_slots);
+        f = &frames[frames_num];
+        f->p = call;
+        f->r = call_r;
+        f->e = MPC_ERRORS_OF(frames_num-1);
+        f->base = stack_num;
+        f->j = 0;
+        f->span = -1;
+        f->m = NULL;
+        frames_num++;
+        resume = 0;
       }
+      call = NULL;
+    }
 
-    /* Combinatory Parsers */
+    f = &frames[frames_num-1];
+    p = f->p;
+    r = &stack[f->r];
+    results = stack + f->base;
 
-    case MPC_TYPE_OR:
+    /* A parser only outputting what it consumed just notes where it started */
+    if (!resume && p->span && !p->memo && !i->span
+    &&  i->type == MPC_INPUT_STRING && i->backtrack > 0) {
+      f->span = i->state.pos;
+      i->span = 1;
+    }
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+    if (!resume && p->memo && mpc_memo_enter(i, f, r, MPC_ERRORS, &t)) {
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      /* Replayed from the memo table */
 
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+    } else if (!resume) switch (p->type) {
+
+      case MPC_TYPE_DFA:
+        if (mpc_parse_leaf(i, p, r, &t)) { break; }
+        MPC_CALL(p->data.dfa.x, f->r);
+
+      case MPC_TYPE_CHARSET:
+        if (mpc_parse_leaf(i, p, r, &t)) { break; }
+        MPC_CALL(p->data.charset.x, f->r);
+
+      /* Application Parsers */
+
+      case MPC_TYPE_APPLY:      MPC_CALL(p->data.apply.x, f->r);
+      case MPC_TYPE_APPLY_TO:   MPC_CALL(p->data.apply_to.x, f->r);
+      case MPC_TYPE_CHECK:      MPC_CALL(p->data.check.x, f->r);
+      case MPC_TYPE_CHECK_WITH: MPC_CALL(p->data.check_with.x, f->r);
+
+      case MPC_TYPE_EXPECT:
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.expect.x, f->r);
+
+      case MPC_TYPE_PREDICT:
+        mpc_input_backtrack_disable(i);
+        MPC_CALL(p->data.predict.x, f->r);
+
+      /* Optional Parsers */
+
+      case MPC_TYPE_NOT:
+        mpc_input_mark(i);
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.not.x, f->r);
+
+      case MPC_TYPE_MAYBE: MPC_CALL(p->data.not.x, f->r);
+
+      /* Repeat Parsers */
+
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+      case MPC_TYPE_COUNT:
+        MPC_CALL_NEXT(p->data.repeat.x);
+
+      /* Combinatory Parsers */
+
+      case MPC_TYPE_OR:
+        if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+        f->j = mpc_or_predict(i, p, 0);
+        if (f->j == p->data.or.n) { MPC_FAILURE(NULL); }
+        MPC_CALL(p->data.or.xs[f->j], f->r);
+
+      case MPC_TYPE_AND:
+        if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+        mpc_input_mark(i);
+        MPC_CALL_NEXT(p->data.and.xs[0]);
+
+      /* End */
+
+      default:
+        if (mpc_parse_leaf(i, p, r, &t)) { break; }
+        MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+
+    } else switch (p->type) {
+
+      /* Resumed with the result `t` of the parser last called */
+
+      case MPC_TYPE_APPLY:
+        if (t) { MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output)); }
+        else { MPC_FAILURE(r->output); }
+
+      case MPC_TYPE_APPLY_TO:
+        if (t) { MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d)); }
+        else { MPC_FAILURE(r->error); }
+
+      case MPC_TYPE_CHECK:
+        if (!t) { MPC_FAILURE(r->error); }
+        if (p->data.check.f(&r->output)) { MPC_SUCCESS(r->output); }
+        mpc_parse_dtor(i, p->data.check.dx, r->output);
+        MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
+
+      case MPC_TYPE_CHECK_WITH:
+        if (!t) { MPC_FAILURE(r->error); }
+        if (p->data.check_with.f(&r->output, p->data.check_with.d)) { MPC_SUCCESS(r->output); }
+        mpc_parse_dtor(i, p->data.check.dx, r->output);
+        MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
+
+      case MPC_TYPE_EXPECT:
+        mpc_input_suppress_disable(i);
+        if (t) { MPC_SUCCESS(r->output); }
+        else { MPC_FAILURE(mpc_err_new(i, p->data.expect.m)); }
+
+      case MPC_TYPE_PREDICT:
+        mpc_input_backtrack_enable(i);
+        if (t) { MPC_SUCCESS(r->output); }
+        else { MPC_FAILURE(r->error); }
+
+      /* TODO: Update Not Error Message */
+
+      case MPC_TYPE_NOT:
+        if (t) {
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          mpc_parse_dtor(i, p->data.not.dx, r->output);
+          MPC_FAILURE(mpc_err_new(i, "opposite"));
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          MPC_SUCCESS(p->data.not.lf());
         }
-      }
-
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
-    case MPC_TYPE_AND:
+      case MPC_TYPE_MAYBE:
+        if (t) { MPC_SUCCESS(r->output); }
+        e = MPC_ERRORS;
+        *e = mpc_err_merge(i, *e, r->error);
+        MPC_SUCCESS(i->span ? NULL : p->data.not.lf());
 
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+        if (t) {
+          f->j++;
+          MPC_CALL_NEXT(p->data.repeat.x);
+        }
+        if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+          MPC_FAILURE(mpc_err_many1(i, results[0].error));
+        }
+        e = MPC_ERRORS;
+        *e = mpc_err_merge(i, *e, results[f->j].error);
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)results));
+
+      case MPC_TYPE_COUNT:
+        if (t) {
+          f->j++;
+          if (f->j != p->data.repeat.n) { MPC_CALL_NEXT(p->data.repeat.x); }
+        }
+        if (f->j == p->data.repeat.n) {
+          MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)results));
+        }
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
+        }
+        MPC_FAILURE(mpc_err_count(i, results[f->j].error, p->data.repeat.n));
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      case MPC_TYPE_OR:
+        if (t) { MPC_SUCCESS(r->output); }
+        e = MPC_ERRORS;
+        *e = mpc_err_merge(i, *e, r->error);
+        f->j = mpc_or_predict(i, p, f->j + 1);
+        if (f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j], f->r); }
+        MPC_FAILURE(NULL);
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
+      case MPC_TYPE_AND:
+        if (!t) {
           mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
+          for (k = 0; k < f->j; k++) {
             mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          MPC_FAILURE(results[f->j].error);
         }
-      }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        if (++f->j < p->data.and.n) { MPC_CALL_NEXT(p->data.and.xs[f->j]); }
+        mpc_input_unmark(i);
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)results));
 
-    /* End */
+      case MPC_TYPE_DFA:
+      case MPC_TYPE_CHARSET:
+        break;
 
-    default:
+      default:
+        MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    }
+
+    /* Return `t` to the frame below */
+
+    if (f->span != -1) {
+      i->span = 0;
+      if (t) {
+        r->output = mpc_malloc(i, i->state.pos - f->span + 1);
+        memcpy(r->output, i->string + f->span, i->state.pos - f->span);
+        ((char*)r->output)[i->state.pos - f->span] = '\0';
+      }
+    }
+
+    if (f->m) {
+      mpc_memo_store(i, f, r, t);
+      e = MPC_ERRORS_AT(f->e);
+      *e = mpc_err_merge(i, *e, f->errors);
+    }
 
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    stack_num = f->base;
+    frames_num--;
+    if (frames_num == 0) { break; }
+    resume = 1;
   }
 
-  return 0;
+  *r0 = stack[0];
+  free(frames);
+  free(stack);
+  return t;
 
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+#undef MPC_STACK_GROW
+#undef MPC_ERRORS_OF
+#undef MPC_ERRORS_AT
+#undef MPC_ERRORS
+#undef MPC_CALL
+#undef MPC_CALL_NEXT
+
+/* Drops the memo table, after which nodes of the output it shared are unshared */
+static void mpc_input_memo_end(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, int x) {
+  if (i->memo == NULL) { return; }
+  mpc_input_memo_delete(i);
+  if (x && p->memo) { r->output = mpc_ast_unshare_all(r->output); }
+}
+
+/* Gives the parse an arena if `p` is a rule of a grammar made with MPCA_LANG_ARENA */
+static void mpc_input_arena_begin(mpc_input_t *i, mpc_parser_t *p) {
+  i->arena = p->arena ? mpc_ast_arena_new() : NULL;
+}
+
+/* Makes the output the root of the arena, or releases the arena if the output isn't in it */
+static void mpc_input_arena_end(mpc_input_t *i, mpc_result_t *r, int x) {
+  if (i->arena == NULL) { return; }
+  if (x && mpc_ast_arena_owns(i->arena, r->output)) {
+    i->arena->root = r->output;
+  } else {
+    mpc_ast_arena_delete(i->arena);
+  }
+  i->arena = NULL;
+}
+
+/*
+** Most errors built during a parse are thrown away
+** when an enclosing alternative succeeds, so for
+** strings parsed with rules of a grammar made with
+** MPCA_LANG_LAZY_ERRORS none are built at all, and
+** compiled regexes and prediction are used. Only if
+** the parse fails is it run again, with the
+** combinators alone, to put together the error.
+** Everything else is parsed once with the
+** combinators alone, building the error as it goes,
+** because compiled regexes and prediction don't
+** record what they expected on the way.
+*/
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
+  mpc_state_t s = i->state;
+  char last = i->last;
+  mpc_err_t *e = NULL;
+
+  if (i->type == MPC_INPUT_STRING && !i->diagnose && p->lazy) {
+    mpc_input_suppress_enable(i);
+    mpc_input_arena_begin(i, p);
+    x = mpc_parse_run(i, p, r, &e);
+    mpc_input_suppress_disable(i);
+    mpc_input_memo_end(i, p, r, x);
+    mpc_input_arena_end(i, r, x);
+    if (x) {
+      mpc_err_delete_internal(i, e);
+      r->output = mpc_export(i, r->output);
+      return x;
+    }
+    mpc_err_delete_internal(i, mpc_err_merge(i, e, r->error));
+    i->state = s;
+    i->last = last;
+    i->diagnose++;
+    x = mpc_parse_input(i, p, r);
+    i->diagnose--;
+    return x;
+  }
+
+  i->diagnose++;
+  e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
+  mpc_input_arena_begin(i, p);
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_input_memo_end(i, p, r, x);
+  mpc_input_arena_end(i, r, x);
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
     r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
+  i->diagnose--;
   return x;
 }
 
@@ -1383,6 +2063,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_or_first_delete(p);
 
 }
 
@@ -1407,6 +2088,9 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
 
     case MPC_TYPE_ONEOF:
     case MPC_TYPE_NONEOF:
+      free(p->data.oneof.x);
+      break;
+
     case MPC_TYPE_STRING:
       free(p->data.string.x);
       break;
@@ -1425,6 +2109,16 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       free(p->data.expect.m);
       break;
 
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      free(p->data.dfa.table);
+      free(p->data.dfa.accept);
+      break;
+
+    case MPC_TYPE_CHARSET:
+      mpc_undefine_unretained(p->data.charset.x, 0);
+      break;
+
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
     case MPC_TYPE_COUNT:
@@ -1454,6 +2148,8 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
 
 }
 
+static void mpc_tag_release(mpc_parser_t *p);
+
 void mpc_delete(mpc_parser_t *p) {
   if (p->retained) {
 
@@ -1461,6 +2157,8 @@ void mpc_delete(mpc_parser_t *p) {
       mpc_undefine_unretained(p, 0);
     }
 
+    mpc_tag_release(p);
+    mpc_predict_forget(p, 0);
     free(p->name);
     free(p);
 
@@ -1478,6 +2176,15 @@ static mpc_parser_t *mpc_undefined(void) {
   p->retained = 0;
   p->type = MPC_TYPE_UNDEFINED;
   p->name = NULL;
+  p->memo = 0;
+  p->arena = 0;
+  p->tag_ids = 0;
+  p->lazy = 0;
+  p->predict = 0;
+  p->span = 0;
+  p->tag_id = -1;
+  p->groups_num = 0;
+  p->groups = NULL;
   return p;
 }
 
@@ -1499,6 +2206,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   p->retained = a->retained;
   p->type = a->type;
   p->data = a->data;
+  p->span = a->span;
 
   if (a->name) {
     p->name = malloc(strlen(a->name)+1);
@@ -1514,6 +2222,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
 
     case MPC_TYPE_ONEOF:
     case MPC_TYPE_NONEOF:
+      p->data.oneof.x = malloc(strlen(a->data.oneof.x)+1);
+      strcpy(p->data.oneof.x, a->data.oneof.x);
+      break;
+
     case MPC_TYPE_STRING:
       p->data.string.x = malloc(strlen(a->data.string.x)+1);
       strcpy(p->data.string.x, a->data.string.x);
@@ -1534,6 +2246,16 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.expect.m, a->data.expect.m);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.table = malloc(a->data.dfa.n * 256);
+      memcpy(p->data.dfa.table, a->data.dfa.table, a->data.dfa.n * 256);
+      p->data.dfa.accept = malloc(a->data.dfa.n);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.n);
+      break;
+
+    case MPC_TYPE_CHARSET: p->data.charset.x = mpc_copy(a->data.charset.x); break;
+
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
     case MPC_TYPE_COUNT:
@@ -1545,6 +2267,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.first) {
+        p->data.or.first = malloc(a->data.or.n * sizeof(mpc_charset_t));
+        memcpy(p->data.or.first, a->data.or.first, a->data.or.n * sizeof(mpc_charset_t));
+        p->data.or.group->refs++;
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1576,16 +2303,25 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
 }
 
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
+  mpc_predict_forget(p, 1);
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
+  p->memo = 0;
+  p->arena = 0;
+  p->tag_ids = 0;
+  p->lazy = 0;
+  p->span = 0;
   return p;
 }
 
 mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
 
+  mpc_predict_forget(p, 1);
+
   if (p->retained) {
     p->type = a->type;
     p->data = a->data;
+    p->span = a->span;
   } else {
     mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
     p->type = a2->type;
@@ -1604,6 +2340,8 @@ void mpc_cleanup(int n, ...) {
   va_list va;
   va_start(va, n);
   for (i = 0; i < n; i++) { list[i] = va_arg(va, mpc_parser_t*); }
+  /* These are deleted, so predictions that looked through them don't need to go stale */
+  for (i = 0; i < n; i++) { mpc_predict_forget(list[i], 0); }
   for (i = 0; i < n; i++) { mpc_undefine(list[i]); }
   for (i = 0; i < n; i++) { mpc_delete(list[i]); }
   va_end(va);
@@ -1770,18 +2508,28 @@ mpc_parser_t *mpc_range(char s, char e) {
 }
 
 mpc_parser_t *mpc_oneof(const char *s) {
+  int c;
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  memset(p->data.oneof.set, 0, sizeof(mpc_charset_t));
+  for (c = 1; c < 256; c++) {
+    if (strchr(s, (char)c) != 0) { mpc_charset_add(p->data.oneof.set, c); }
+  }
   return mpc_expectf(p, "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_noneof(const char *s) {
+  int c;
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  memset(p->data.oneof.set, 0, sizeof(mpc_charset_t));
+  for (c = 1; c < 256; c++) {
+    if (strchr(s, (char)c) == 0) { mpc_charset_add(p->data.oneof.set, c); }
+  }
   return mpc_expectf(p, "none of '%s'", s);
 
 }
@@ -2360,86 +3108,586 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  return mpc_re_mode(re, MPC_RE_DEFAULT);
+/*
+** Regex Compilation
+**
+** Regexes built only from characters, classes,
+** sequences, alternatives and repeats are also
+** compiled to a DFA, which matches a token in a
+** single loop instead of one combinator call per
+** character.
+**
+** A DFA finds the longest match, while the
+** combinators never give back what a repeat has
+** consumed and take the first alternative that
+** works. These agree when every choice can be
+** made by looking at the next character: the
+** alternatives start with different characters,
+** and nothing a repeat or option could consume
+** can also start what follows it. Only regexes
+** that pass that check are compiled.
+*/
+
+enum {
+  MPC_DFA_STATES_MAX = 255,
+  MPC_NFA_STATES_MAX = 1024
+};
+
+static void mpc_charset_union(mpc_charset_t s, const mpc_charset_t t) {
+  int j;
+  for (j = 0; j < 32; j++) { s[j] |= t[j]; }
 }
 
-mpc_parser_t *mpc_re_mode(const char *re, int mode) {
+static int mpc_charset_meets(const mpc_charset_t s, const mpc_charset_t t) {
+  int j;
+  for (j = 0; j < 32; j++) { if (s[j] & t[j]) { return 1; } }
+  return 0;
+}
 
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+/* The characters a primitive accepts. The end of input is never one of them */
+static int mpc_charset_of(mpc_parser_t *p, mpc_charset_t s) {
+  int c;
+  memset(s, 0, sizeof(mpc_charset_t));
+  for (c = 1; c < 256; c++) {
+    switch (p->type) {
+      case MPC_TYPE_ANY:    mpc_charset_add(s, c); break;
+      case MPC_TYPE_SINGLE: if ((char)c == p->data.single.x) { mpc_charset_add(s, c); } break;
+      case MPC_TYPE_RANGE:
+        if ((char)c >= p->data.range.x && (char)c <= p->data.range.y) { mpc_charset_add(s, c); }
+        break;
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF:
+        if (mpc_charset_has(p->data.oneof.set, c)) { mpc_charset_add(s, c); }
+        break;
+      case MPC_TYPE_CHARSET:
+        if (mpc_charset_has(p->data.charset.set, c)) { mpc_charset_add(s, c); }
+        break;
+      default: return 0;
+    }
+  }
+  return 1;
+}
 
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
+/*
+** Checks `p` can be compiled when followed by the characters
+** in `follow`, setting the characters it can start with and
+** whether it can match nothing. Returns zero if it can't be
+** compiled.
+*/
 
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
+static int mpc_re_deterministic(mpc_parser_t *p, const mpc_charset_t follow, mpc_charset_t first, int *nullable) {
 
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+  int j, k;
+  int null_x;
+  mpc_charset_t tail, first_x, follow_x;
 
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
+  memset(first, 0, sizeof(mpc_charset_t));
+  *nullable = 0;
 
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
-    mpc_apply_to(mpc_noneof(")|"), mpcf_re_escape, &mode)
-  ));
+  if (p->retained) { return 0; }
 
-  mpc_define(Range, mpc_apply(
-    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
-    mpcf_re_range
-  ));
+  switch (p->type) {
 
-  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_CHARSET:
+      mpc_charset_of(p, first);
+      return 1;
 
-  mpc_optimise(RegexEnclose);
-  mpc_optimise(Regex);
-  mpc_optimise(Term);
-  mpc_optimise(Factor);
-  mpc_optimise(Base);
-  mpc_optimise(Range);
+    case MPC_TYPE_LIFT:
+      if (p->data.lift.lf != mpcf_ctor_str) { return 0; }
+      *nullable = 1;
+      return 1;
 
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
-    err_msg = mpc_err_string(r.error);
-    err_out = mpc_failf("Invalid Regex: %s", err_msg);
-    mpc_err_delete(r.error);
-    free(err_msg);
-    r.output = err_out;
-  }
+    case MPC_TYPE_EXPECT:
+      return mpc_re_deterministic(p->data.expect.x, follow, first, nullable);
 
-  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      memcpy(tail, follow, sizeof(mpc_charset_t));
+      *nullable = 1;
+      for (j = p->data.and.n-1; j >= 0; j--) {
+        if (!mpc_re_deterministic(p->data.and.xs[j], tail, first_x, &null_x)) { return 0; }
+        if (!null_x) { memset(tail, 0, sizeof(mpc_charset_t)); }
+        mpc_charset_union(tail, first_x);
+        *nullable = *nullable && null_x;
+      }
+      memcpy(first, tail, sizeof(mpc_charset_t));
+      if (!*nullable) { return 1; }
+      /* A nullable sequence only starts with its own characters */
+      memset(first, 0, sizeof(mpc_charset_t));
+      for (j = 0; j < p->data.and.n; j++) {
+        mpc_re_deterministic(p->data.and.xs[j], follow, first_x, &null_x);
+        mpc_charset_union(first, first_x);
+      }
+      return 1;
 
-  mpc_optimise(r.output);
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_re_deterministic(p->data.or.xs[j], follow, first_x, &null_x)
+        ||  null_x || mpc_charset_meets(first, first_x)) { return 0; }
+        mpc_charset_union(first, first_x);
+      }
+      return 1;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      if (!mpc_re_deterministic(p->data.not.x, follow, first, &null_x)
+      ||  null_x || mpc_charset_meets(first, follow)) { return 0; }
+      *nullable = 1;
+      return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n < 1) { return 0; }
+
+      /* Find what `x` starts with, then check it again knowing it can follow itself */
+      if (!mpc_re_deterministic(p->data.repeat.x, follow, first, &null_x) || null_x) { return 0; }
+      if (p->type != MPC_TYPE_COUNT && mpc_charset_meets(first, follow)) { return 0; }
+      memcpy(follow_x, follow, sizeof(mpc_charset_t));
+      mpc_charset_union(follow_x, first);
+      if (!mpc_re_deterministic(p->data.repeat.x, follow_x, first_x, &k)) { return 0; }
+      *nullable = p->type == MPC_TYPE_MANY;
+      return 1;
 
-  return r.output;
+    default: return 0;
+  }
 
 }
 
 /*
-** Common Fold Functions
+** The DFA is built by subset construction from an
+** NFA where each state has at most one character
+** class edge and two empty edges.
 */
 
-void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
+typedef struct {
+  int eps[2];
+  int next;
+  mpc_charset_t set;
+} mpc_nfa_state_t;
 
-mpc_val_t *mpcf_ctor_null(void) { return NULL; }
-mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
-mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
+typedef struct {
+  int num;
+  mpc_nfa_state_t *states;
+} mpc_nfa_t;
+
+static int mpc_nfa_new(mpc_nfa_t *n) {
+  if (n->num == MPC_NFA_STATES_MAX) { return -1; }
+  n->states[n->num].eps[0] = -1;
+  n->states[n->num].eps[1] = -1;
+  n->states[n->num].next = -1;
+  memset(n->states[n->num].set, 0, sizeof(mpc_charset_t));
+  return n->num++;
+}
+
+static void mpc_nfa_eps(mpc_nfa_t *n, int s, int t) {
+  n->states[s].eps[n->states[s].eps[0] == -1 ? 0 : 1] = t;
+}
+
+/* Adds the states for `p` from `s`, which has no edges yet, returning its end state or -1 if out of states */
+static int mpc_nfa_build(mpc_nfa_t *n, mpc_parser_t *p, int s) {
+
+  int j, a, t, l;
+
+  if (s == -1) { return -1; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_LIFT: return s;
+    case MPC_TYPE_EXPECT: return mpc_nfa_build(n, p->data.expect.x, s);
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) { s = mpc_nfa_build(n, p->data.and.xs[j], s); }
+      return s;
+
+    case MPC_TYPE_COUNT:
+      for (j = 0; j < p->data.repeat.n; j++) { s = mpc_nfa_build(n, p->data.repeat.x, s); }
+      return s;
+
+    case MPC_TYPE_OR:
+      if ((t = mpc_nfa_new(n)) == -1) { return -1; }
+      for (j = 0; j < p->data.or.n; j++) {
+        a = s;
+        if (j < p->data.or.n-1) {
+          if ((a = mpc_nfa_new(n)) == -1) { return -1; }
+          if ((l = mpc_nfa_new(n)) == -1) { return -1; }
+          mpc_nfa_eps(n, s, a);
+          mpc_nfa_eps(n, s, l);
+          s = l;
+        }
+        if ((a = mpc_nfa_build(n, p->data.or.xs[j], a)) == -1) { return -1; }
+        mpc_nfa_eps(n, a, t);
+      }
+      return t;
+
+    case MPC_TYPE_MAYBE:
+      if ((a = mpc_nfa_new(n)) == -1) { return -1; }
+      if ((t = mpc_nfa_new(n)) == -1) { return -1; }
+      mpc_nfa_eps(n, s, a);
+      mpc_nfa_eps(n, s, t);
+      if ((a = mpc_nfa_build(n, p->data.not.x, a)) == -1) { return -1; }
+      mpc_nfa_eps(n, a, t);
+      return t;
+
+    case MPC_TYPE_MANY1:
+      if ((s = mpc_nfa_build(n, p->data.repeat.x, s)) == -1) { return -1; }
+      /* Fallthrough */
+    case MPC_TYPE_MANY:
+      if ((l = mpc_nfa_new(n)) == -1) { return -1; }
+      if ((a = mpc_nfa_new(n)) == -1) { return -1; }
+      if ((t = mpc_nfa_new(n)) == -1) { return -1; }
+      mpc_nfa_eps(n, s, l);
+      mpc_nfa_eps(n, l, a);
+      mpc_nfa_eps(n, l, t);
+      if ((a = mpc_nfa_build(n, p->data.repeat.x, a)) == -1) { return -1; }
+      mpc_nfa_eps(n, a, l);
+      return t;
+
+    default:
+      if ((t = mpc_nfa_new(n)) == -1) { return -1; }
+      mpc_charset_of(p, n->states[s].set);
+      n->states[s].next = t;
+      return t;
+  }
+
+}
+
+static void mpc_nfa_closure(mpc_nfa_t *n, char *in, int s) {
+  if (s == -1 || in[s]) { return; }
+  in[s] = 1;
+  mpc_nfa_closure(n, in, n->states[s].eps[0]);
+  mpc_nfa_closure(n, in, n->states[s].eps[1]);
+}
+
+/* Wraps the combinators of a regex in a DFA parser if it can be compiled */
+static mpc_parser_t *mpc_re_compile(mpc_parser_t *x) {
+
+  int j, c, q, nullable, end, num;
+  mpc_charset_t none, first;
+  mpc_nfa_t n;
+  char *sets, *next, *accept;
+  unsigned char *table;
+  mpc_parser_t *p;
+
+  memset(none, 0, sizeof(mpc_charset_t));
+  if (!mpc_re_deterministic(x, none, first, &nullable)) { return x; }
+
+  n.num = 0;
+  n.states = malloc(sizeof(mpc_nfa_state_t) * MPC_NFA_STATES_MAX);
+  end = mpc_nfa_build(&n, x, mpc_nfa_new(&n));
+  if (end == -1) { free(n.states); return x; }
+
+  /* DFA state 0 is dead and 1 is the start, each standing for a set of NFA states */
+  sets = calloc((MPC_DFA_STATES_MAX + 1) * n.num, 1);
+  next = malloc(n.num);
+  table = calloc((MPC_DFA_STATES_MAX + 1) * 256, 1);
+  accept = calloc(MPC_DFA_STATES_MAX + 1, 1);
+  mpc_nfa_closure(&n, sets + n.num, 0);
+  num = 2;
+
+  for (q = 1; q < num; q++) {
+    accept[q] = sets[q * n.num + end];
+    for (c = 1; c < 256; c++) {
+
+      memset(next, 0, n.num);
+      for (j = 0; j < n.num; j++) {
+        if (sets[q * n.num + j] && n.states[j].next != -1
+        && mpc_charset_has(n.states[j].set, c)) {
+          mpc_nfa_closure(&n, next, n.states[j].next);
+        }
+      }
+      if (memchr(next, 1, n.num) == NULL) { continue; }
+
+      for (j = 1; j < num; j++) {
+        if (memcmp(sets + j * n.num, next, n.num) == 0) { break; }
+      }
+      if (j == num) {
+        if (num > MPC_DFA_STATES_MAX) { break; }
+        memcpy(sets + j * n.num, next, n.num);
+        num++;
+      }
+      table[q * 256 + c] = (unsigned char)j;
+    }
+    if (c < 256) { break; }
+  }
+
+  free(sets);
+  free(next);
+  free(n.states);
+
+  if (q < num) {
+    free(table);
+    free(accept);
+    return x;
+  }
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = x;
+  p->data.dfa.n = num;
+  p->data.dfa.table = realloc(table, num * 256);
+  p->data.dfa.accept = realloc(accept, num);
+  return p;
+}
+
+/*
+** Sets the characters `p` can start with and returns
+** whether it can match nothing. Anything not known is
+** taken to start with any character. Rules looked
+** through note that the tables of group `g` use them.
+*/
+
+static int mpc_predict_first(mpc_parser_t *p, mpc_charset_t s, mpc_predict_group_t *g) {
+
+  int j, null_x, nullable = 0;
+  mpc_charset_t first_x;
+
+  memset(s, 0, sizeof(mpc_charset_t));
+
+  if (p->retained) {
+    if (p->predict & MPC_PREDICT_OPEN) {
+      memset(s, 0xFF, sizeof(mpc_charset_t));
+      return 1;
+    }
+    p->predict |= MPC_PREDICT_OPEN;
+    j = 0;
+    while (j < p->groups_num && p->groups[j] != g) { j++; }
+    if (j == p->groups_num) {
+      p->groups = realloc(p->groups, sizeof(mpc_predict_group_t*) * (p->groups_num + 1));
+      p->groups[p->groups_num++] = g;
+      g->refs++;
+    }
+  }
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_CHARSET:
+      mpc_charset_of(p, s);
+      break;
+
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { nullable = 1; }
+      else { mpc_charset_add(s, (unsigned char)p->data.string.x[0]); }
+      break;
+
+    /* Neither of these ever consumes anything */
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_FAIL:
+      break;
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      nullable = 1;
+      break;
+
+    case MPC_TYPE_DFA:        nullable = mpc_predict_first(p->data.dfa.x, s, g);        break;
+    case MPC_TYPE_EXPECT:     nullable = mpc_predict_first(p->data.expect.x, s, g);     break;
+    case MPC_TYPE_APPLY:      nullable = mpc_predict_first(p->data.apply.x, s, g);      break;
+    case MPC_TYPE_APPLY_TO:   nullable = mpc_predict_first(p->data.apply_to.x, s, g);   break;
+    case MPC_TYPE_CHECK:      nullable = mpc_predict_first(p->data.check.x, s, g);      break;
+    case MPC_TYPE_CHECK_WITH: nullable = mpc_predict_first(p->data.check_with.x, s, g); break;
+    case MPC_TYPE_PREDICT:    nullable = mpc_predict_first(p->data.predict.x, s, g);    break;
+
+    /* In predictive mode `not` can succeed having consumed what `x` started with */
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_predict_first(p->data.not.x, s, g);
+      nullable = 1;
+      break;
+
+    case MPC_TYPE_MANY:
+      mpc_predict_first(p->data.repeat.x, s, g);
+      nullable = 1;
+      break;
+
+    case MPC_TYPE_MANY1: nullable = mpc_predict_first(p->data.repeat.x, s, g); break;
+
+    case MPC_TYPE_COUNT:
+      nullable = mpc_predict_first(p->data.repeat.x, s, g) || p->data.repeat.n == 0;
+      break;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        nullable = mpc_predict_first(p->data.or.xs[j], first_x, g) || nullable;
+        mpc_charset_union(s, first_x);
+      }
+      break;
+
+    case MPC_TYPE_AND:
+      nullable = 1;
+      for (j = 0; j < p->data.and.n && nullable; j++) {
+        null_x = mpc_predict_first(p->data.and.xs[j], first_x, g);
+        mpc_charset_union(s, first_x);
+        nullable = null_x;
+      }
+      break;
+
+    default:
+      memset(s, 0xFF, sizeof(mpc_charset_t));
+      nullable = 1;
+      break;
+  }
+
+  if (p->retained) { p->predict &= ~MPC_PREDICT_OPEN; }
+
+  return nullable;
+}
+
+/* Notes the characters that start each `or` alternative */
+static void mpc_predict_unretained(mpc_parser_t *p, int force, mpc_predict_group_t *g) {
+
+  int j, skips = 0;
+  mpc_charset_t all;
+
+  if (p->retained && !force) { return; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_DFA:        mpc_predict_unretained(p->data.dfa.x, 0, g);        break;
+    case MPC_TYPE_EXPECT:     mpc_predict_unretained(p->data.expect.x, 0, g);     break;
+    case MPC_TYPE_APPLY:      mpc_predict_unretained(p->data.apply.x, 0, g);      break;
+    case MPC_TYPE_APPLY_TO:   mpc_predict_unretained(p->data.apply_to.x, 0, g);   break;
+    case MPC_TYPE_CHECK:      mpc_predict_unretained(p->data.check.x, 0, g);      break;
+    case MPC_TYPE_CHECK_WITH: mpc_predict_unretained(p->data.check_with.x, 0, g); break;
+    case MPC_TYPE_PREDICT:    mpc_predict_unretained(p->data.predict.x, 0, g);    break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_predict_unretained(p->data.not.x, 0, g);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_predict_unretained(p->data.repeat.x, 0, g);
+      break;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        mpc_predict_unretained(p->data.and.xs[j], 0, g);
+      }
+      break;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_predict_unretained(p->data.or.xs[j], 0, g);
+      }
+      mpc_or_first_delete(p);
+      p->data.or.first = malloc(p->data.or.n * sizeof(mpc_charset_t));
+      p->data.or.group = g;
+      g->refs++;
+      memset(all, 0xFF, sizeof(mpc_charset_t));
+      for (j = 0; j < p->data.or.n; j++) {
+        if (mpc_predict_first(p->data.or.xs[j], p->data.or.first[j], g)) {
+          memcpy(p->data.or.first[j], all, sizeof(mpc_charset_t));
+        }
+        skips = skips || memcmp(p->data.or.first[j], all, sizeof(mpc_charset_t)) != 0;
+      }
+      /* Not worth checking if nothing can be skipped */
+      if (!skips) { mpc_or_first_delete(p); }
+      break;
+
+    default: break;
+  }
+
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  return mpc_re_mode(re, MPC_RE_DEFAULT);
+}
+
+mpc_parser_t *mpc_re_mode(const char *re, int mode) {
+
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
+
+  mpc_define(Regex, mpc_and(2, mpcf_re_or,
+    Term,
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+
+  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
+    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
+    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
+    mpc_apply_to(mpc_noneof(")|"), mpcf_re_escape, &mode)
+  ));
+
+  mpc_define(Range, mpc_apply(
+    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
+    mpcf_re_range
+  ));
+
+  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+
+  mpc_optimise(RegexEnclose);
+  mpc_optimise(Regex);
+  mpc_optimise(Term);
+  mpc_optimise(Factor);
+  mpc_optimise(Base);
+  mpc_optimise(Range);
+
+  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+    err_msg = mpc_err_string(r.error);
+    err_out = mpc_failf("Invalid Regex: %s", err_msg);
+    mpc_err_delete(r.error);
+    free(err_msg);
+    r.output = err_out;
+  }
+
+  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
+
+  mpc_optimise(r.output);
+
+  return mpc_re_compile(r.output);
+
+}
+
+/*
+** Common Fold Functions
+*/
+
+void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
+
+mpc_val_t *mpcf_ctor_null(void) { return NULL; }
+mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
+mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
 
 mpc_val_t *mpcf_int(mpc_val_t *x) {
   int *y = malloc(sizeof(int));
@@ -2657,16 +3905,19 @@ mpc_val_t *mpcf_all_free(int n, mpc_val_t** xs) {
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
   int i;
-  size_t l = 0;
+  size_t l = 0, k;
 
   if (n == 0) { return calloc(1, 1); }
 
   for (i = 0; i < n; i++) { l += strlen(xs[i]); }
 
+  k = strlen(xs[0]);
   xs[0] = realloc(xs[0], l + 1);
 
   for (i = 1; i < n; i++) {
-    strcat(xs[0], xs[i]); free(xs[i]);
+    strcpy((char*)xs[0] + k, xs[i]);
+    k += strlen(xs[i]);
+    free(xs[i]);
   }
 
   return xs[0];
@@ -2696,6 +3947,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_LIFT)   { printf("<#>"); }
   if (p->type == MPC_TYPE_STATE)  { printf("<S>"); }
   if (p->type == MPC_TYPE_ANCHOR) { printf("<@>"); }
+  if (p->type == MPC_TYPE_DFA) { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_CHARSET) { mpc_print_unretained(p->data.charset.x, 0); }
   if (p->type == MPC_TYPE_EXPECT) {
     printf("%s", p->data.expect.m);
     /*mpc_print_unretained(p->data.expect.x, 0);*/
@@ -2732,7 +3985,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
 
   if (p->type == MPC_TYPE_ONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
@@ -2741,7 +3994,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
 
   if (p->type == MPC_TYPE_NONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
@@ -2879,6 +4132,12 @@ void mpc_ast_delete(mpc_ast_t *a) {
   int i;
 
   if (a == NULL) { return; }
+  if (a->shared) { a->shared--; return; }
+
+  if (a->arena) {
+    if (a->arena->root == a) { mpc_ast_arena_delete(a->arena); }
+    return;
+  }
 
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
@@ -2891,46 +4150,128 @@ void mpc_ast_delete(mpc_ast_t *a) {
 
 }
 
-static void mpc_ast_delete_no_children(mpc_ast_t *a) {
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+/* Arena child arrays hold at least four and grow in powers of two, so their size needn't be stored */
+static int mpc_ast_arena_slots(int n) {
+  int k = 4;
+  while (k < n) { k *= 2; }
+  return n ? k : 0;
 }
 
-mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
-
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
-
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
-
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
-
-  a->state = mpc_state_new();
-
-  a->children_num = 0;
-  a->children = NULL;
+/* Adds a holder to `a`, which deleting it takes away again */
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a) {
+  if (a) { a->shared++; }
   return a;
-
 }
 
-mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
-
-  mpc_ast_t *a = mpc_ast_new(tag, "");
+/* Gives the caller a node of its own to change, copying `a` but not its children if it is shared */
+static mpc_ast_t *mpc_ast_unshare(mpc_ast_t *a) {
 
   int i;
-  va_list va;
-  va_start(va, tag);
+  mpc_ast_t *b;
 
-  for (i = 0; i < n; i++) {
-    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
-  }
+  if (a == NULL || a->shared == 0) { return a; }
 
-  va_end(va);
+  b = mpc_ast_new_in(a->arena, a->tag, a->contents);
+  b->tags = a->tags;
+  b->state = a->state;
+  b->children_num = a->children_num;
 
-  return a;
+  if (b->arena) {
+    b->children = a->children_num ? mpc_ast_arena_alloc(b->arena, sizeof(mpc_ast_t*) * mpc_ast_arena_slots(a->children_num)) : NULL;
+  } else {
+    b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  }
+
+  for (i = 0; i < a->children_num; i++) {
+    b->children[i] = mpc_ast_share(a->children[i]);
+    if (b->arena && b->children[i] && b->children[i]->arena != b->arena) {
+      mpc_ast_arena_adopt(b->arena, b->children[i]);
+    }
+  }
+
+  a->shared--;
+  return b;
+}
+
+/* Unshares every node of a finished AST, so each is only in it once */
+static mpc_ast_t *mpc_ast_unshare_all(mpc_ast_t *a) {
+  int i;
+  a = mpc_ast_unshare(a);
+  if (a == NULL) { return a; }
+  for (i = 0; i < a->children_num; i++) {
+    a->children[i] = mpc_ast_unshare_all(a->children[i]);
+  }
+  return a;
+}
+
+/* Ids of the tags `mpc` itself gives nodes, found by the first character so no full compare is needed */
+static mpc_tags_t mpc_ast_tag_builtin(const char *t) {
+  switch (t[0]) {
+    case '>': return t[1] == '\0' ? MPC_TAG_BIT(MPC_TAG_ROOT) : 0;
+    case 'r': return strcmp(t, "regex") == 0 ? MPC_TAG_BIT(MPC_TAG_REGEX) : 0;
+    case 's': return strcmp(t, "string") == 0 ? MPC_TAG_BIT(MPC_TAG_STRING) : 0;
+    case 'c': return strcmp(t, "char") == 0 ? MPC_TAG_BIT(MPC_TAG_CHAR) : 0;
+    default: return 0;
+  }
+}
+
+/* Deletes `a` once its children have been taken, which must first be shared if `a` is */
+static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->shared) { a->shared--; return; }
+  if (a->arena) { return; }
+  free(a->children);
+  free(a->tag);
+  free(a->contents);
+  free(a);
+}
+
+/* Makes a node in arena `m`, or on the heap if `m` is NULL */
+static mpc_ast_t *mpc_ast_new_in(struct mpc_ast_arena_t *m, const char *tag, const char *contents) {
+
+  mpc_ast_t *a;
+
+  if (m) {
+    a = mpc_ast_arena_alloc(m, sizeof(mpc_ast_t));
+    a->tag = mpc_ast_arena_strdup(m, tag);
+    a->contents = mpc_ast_arena_strdup(m, contents);
+  } else {
+    a = malloc(sizeof(mpc_ast_t));
+    a->tag = malloc(strlen(tag) + 1);
+    strcpy(a->tag, tag);
+    a->contents = malloc(strlen(contents) + 1);
+    strcpy(a->contents, contents);
+  }
+
+  a->tags = mpc_ast_tag_builtin(tag);
+  a->state = mpc_state_new();
+
+  a->children_num = 0;
+  a->children = NULL;
+  a->arena = m;
+  a->shared = 0;
+  return a;
+
+}
+
+mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  return mpc_ast_new_in(NULL, tag, contents);
+}
+
+mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
+
+  mpc_ast_t *a = mpc_ast_new(tag, "");
+
+  int i;
+  va_list va;
+  va_start(va, tag);
+
+  for (i = 0; i < n; i++) {
+    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
+  }
+
+  va_end(va);
+
+  return a;
 
 }
 
@@ -2942,8 +4283,9 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_in(a->arena, ">", "");
   mpc_ast_add_child(r, a);
+  if (a->arena && a->arena->root == a) { a->arena->root = r; }
   return r;
 }
 
@@ -2963,37 +4305,105 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+
+  mpc_ast_t **cs;
+
+  r = mpc_ast_unshare(r);
+
+  if (r->arena == NULL) {
+    r->children_num++;
+    r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+    r->children[r->children_num-1] = a;
+    return r;
+  }
+
+  if (a && a->arena != r->arena) { mpc_ast_arena_adopt(r->arena, a); }
+
+  if (r->children_num == mpc_ast_arena_slots(r->children_num)) {
+    cs = mpc_ast_arena_alloc(r->arena, sizeof(mpc_ast_t*) * mpc_ast_arena_slots(r->children_num + 1));
+    if (r->children_num) { memcpy(cs, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+    r->children = cs;
+  }
+
+  r->children[r->children_num++] = a;
   return r;
 }
 
+/* Puts the first `n` characters of `t`, and a bar if `bar` is set, in front of the tag */
+static mpc_ast_t *mpc_ast_prepend_tag(mpc_ast_t *a, const char *t, size_t n, int bar) {
+  size_t k = n + (bar ? 1 : 0), m;
+  char *x;
+  a = mpc_ast_unshare(a);
+  m = strlen(a->tag);
+  if (a->arena) {
+    x = mpc_ast_arena_alloc(a->arena, k + m + 1);
+    memcpy(x + k, a->tag, m + 1);
+    a->tag = x;
+  } else {
+    a->tag = realloc(a->tag, k + m + 1);
+    memmove(a->tag + k, a->tag, m + 1);
+  }
+  memcpy(a->tag, t, n);
+  if (bar) { a->tag[n] = '|'; }
+  return a;
+}
+
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
-  return a;
+  return mpc_ast_prepend_tag(a, t, strlen(t), 1);
 }
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
-  return a;
+  if (a == NULL || t[0] == '\0' || t[1] == '\0') { return a; }
+  return mpc_ast_prepend_tag(a, t, strlen(t)-1, 0);
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
+  a = mpc_ast_unshare(a);
+  if (a->arena) {
+    a->tag = mpc_ast_arena_strdup(a->arena, t);
+  } else {
+    a->tag = realloc(a->tag, strlen(t) + 1);
+    strcpy(a->tag, t);
+  }
+  a->tags = mpc_ast_tag_builtin(t);
+  return a;
+}
+
+/* Adds the id of rule `p` to the tag bits and, unless its grammar only uses ids, its name to the tag string */
+static mpc_ast_t *mpc_ast_add_rule_tag(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  a = p->tag_ids ? mpc_ast_unshare(a) : mpc_ast_add_tag(a, p->name);
+  a->tags |= MPC_TAG_BIT(p->tag_id);
   return a;
 }
 
+/* The rule holding each id, so an id means the same rule whichever grammar a node came from */
+static mpc_parser_t *mpc_tag_rules[MPC_TAG_MAX];
+
+int mpc_tag_id(mpc_parser_t *p) {
+  int j;
+  for (j = MPC_TAG_RULE; j < MPC_TAG_MAX && p->tag_id == -1; j++) {
+    if (mpc_tag_rules[j] == NULL) {
+      mpc_tag_rules[j] = p;
+      p->tag_id = j;
+    }
+  }
+  return p->tag_id;
+}
+
+static void mpc_tag_release(mpc_parser_t *p) {
+  if (p->tag_id != -1) { mpc_tag_rules[p->tag_id] = NULL; }
+  p->tag_id = -1;
+}
+
+int mpc_ast_has_tag(mpc_ast_t *a, int id) {
+  return (a->tags & MPC_TAG_BIT(id)) != 0;
+}
+
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   if (a == NULL) { return a; }
+  a = mpc_ast_unshare(a);
   a->state = s;
   return a;
 }
@@ -3204,25 +4614,38 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 
   int i, j;
   mpc_ast_t** as = (mpc_ast_t**)xs;
-  mpc_ast_t *r;
+  mpc_ast_t *r, *c;
+  struct mpc_ast_arena_t *m = NULL;
 
   if (n == 0) { return NULL; }
   if (n == 1) { return xs[0]; }
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
 
-  r = mpc_ast_new(">", "");
+  /* Goes in the arena of the nodes it joins, if they are in one */
+  for (i = 0; i < n && m == NULL; i++) {
+    if (as[i]) { m = as[i]->arena; }
+  }
+
+  r = mpc_ast_new_in(m, ">", "");
 
   for (i = 0; i < n; i++) {
 
     if (as[i] == NULL) { continue; }
 
-    if        (as[i] && as[i]->children_num == 0) {
+    /* Children taken from a shared node are shared with it */
+    if (as[i]->shared) {
+      for (j = 0; j < as[i]->children_num; j++) { mpc_ast_share(as[i]->children[j]); }
+    }
+
+    if        (as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
-    } else if (as[i] && as[i]->children_num == 1) {
-      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+    } else if (as[i]->children_num == 1) {
+      c = mpc_ast_unshare(as[i]->children[0]);
+      c->tags |= as[i]->tags & ~MPC_TAG_BIT(MPC_TAG_ROOT);
+      mpc_ast_add_child(r, mpc_ast_add_root_tag(c, as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
-    } else if (as[i] && as[i]->children_num >= 2) {
+    } else {
       for (j = 0; j < as[i]->children_num; j++) {
         mpc_ast_add_child(r, as[i]->children[j]);
       }
@@ -3503,7 +4926,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpc_apply_to(p, (mpc_apply_to_t)mpc_ast_add_rule_tag, p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3654,6 +5077,10 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
+    left->memo = (st->flags & MPCA_LANG_PACKRAT) != 0;
+    left->arena = (st->flags & MPCA_LANG_ARENA) != 0;
+    left->tag_ids = (st->flags & MPCA_LANG_TAG_IDS) != 0;
+    left->lazy = (st->flags & MPCA_LANG_LAZY_ERRORS) != 0;
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
@@ -3667,8 +5094,10 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
 
 static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
 
+  int j;
   mpc_result_t r;
   mpc_err_t *e;
+  mpc_predict_group_t *g;
   mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base;
 
   Lang    = mpc_new("lang");
@@ -3727,6 +5156,11 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
     e = r.error;
   } else {
     e = NULL;
+    g = mpc_predict_group_new();
+    for (j = 0; j < st->parsers_num; j++) {
+      if (st->parsers[j]) { mpc_predict_unretained(st->parsers[j], 1, g); }
+    }
+    mpc_predict_group_release(g);
   }
 
   mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
@@ -3835,6 +5269,785 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   return err;
 }
 
+/*
+** Saved Grammars
+**
+** A grammar is saved as its parsers in the order
+** they must be built: the children of a parser
+** always come before it, so loading is one pass.
+** References to the named parsers passed in are
+** by their position and everything else is an
+** index into the parsers saved so far.
+**
+** Functions are saved as their position in a table
+** of mpc's own, so only grammars built out of those,
+** such as any from `mpca_lang`, can be saved. The
+** prediction tables are rebuilt on loading.
+*/
+
+typedef void (*mpc_fn_t)(void);
+
+static const mpc_fn_t mpc_save_fns[] = {
+  (mpc_fn_t)free,
+  (mpc_fn_t)mpc_soft_delete,
+  (mpc_fn_t)mpc_ast_delete,
+  (mpc_fn_t)mpc_ast_tag,
+  (mpc_fn_t)mpc_ast_add_tag,
+  (mpc_fn_t)mpc_ast_add_rule_tag,
+  (mpc_fn_t)mpc_ast_add_root,
+  (mpc_fn_t)mpc_boundary_anchor,
+  (mpc_fn_t)mpc_boundary_newline_anchor,
+  (mpc_fn_t)mpcf_dtor_null,
+  (mpc_fn_t)mpcf_ctor_null,
+  (mpc_fn_t)mpcf_ctor_str,
+  (mpc_fn_t)mpcf_free,
+  (mpc_fn_t)mpcf_int,
+  (mpc_fn_t)mpcf_hex,
+  (mpc_fn_t)mpcf_oct,
+  (mpc_fn_t)mpcf_float,
+  (mpc_fn_t)mpcf_strtriml,
+  (mpc_fn_t)mpcf_strtrimr,
+  (mpc_fn_t)mpcf_strtrim,
+  (mpc_fn_t)mpcf_escape,
+  (mpc_fn_t)mpcf_escape_regex,
+  (mpc_fn_t)mpcf_escape_string_raw,
+  (mpc_fn_t)mpcf_escape_char_raw,
+  (mpc_fn_t)mpcf_unescape,
+  (mpc_fn_t)mpcf_unescape_regex,
+  (mpc_fn_t)mpcf_unescape_string_raw,
+  (mpc_fn_t)mpcf_unescape_char_raw,
+  (mpc_fn_t)mpcf_null,
+  (mpc_fn_t)mpcf_fst,
+  (mpc_fn_t)mpcf_snd,
+  (mpc_fn_t)mpcf_trd,
+  (mpc_fn_t)mpcf_fst_free,
+  (mpc_fn_t)mpcf_snd_free,
+  (mpc_fn_t)mpcf_trd_free,
+  (mpc_fn_t)mpcf_all_free,
+  (mpc_fn_t)mpcf_strfold,
+  (mpc_fn_t)mpcf_fold_ast,
+  (mpc_fn_t)mpcf_str_ast,
+  (mpc_fn_t)mpcf_state_ast
+};
+
+enum {
+  MPC_SAVE_FNS_NUM = sizeof(mpc_save_fns) / sizeof(mpc_fn_t),
+  MPC_SAVE_VERSION = 2
+};
+
+static const char *mpc_save_tags[] = { "string", "char", "regex" };
+
+static const char mpc_save_magic[8] = "mpcgram";
+
+typedef struct {
+  FILE *f;
+  int n;
+  mpc_parser_t **roots;
+  int nodes_num;
+  unsigned long check;
+  int ok;
+} mpc_save_t;
+
+/* The file ends with a checksum so damage is noticed rather than built */
+static unsigned long mpc_save_check(unsigned long h, const void *x, size_t n) {
+  size_t j;
+  for (j = 0; j < n; j++) { h = (h ^ ((const unsigned char*)x)[j]) * 16777619UL & 0xFFFFFFFFUL; }
+  return h;
+}
+
+static void mpc_save_bytes(mpc_save_t *s, const void *x, size_t n) {
+  s->check = mpc_save_check(s->check, x, n);
+  if (n && fwrite(x, 1, n, s->f) != n) { s->ok = 0; }
+}
+
+static void mpc_save_int(mpc_save_t *s, int x) {
+  mpc_save_bytes(s, &x, sizeof(int));
+}
+
+static void mpc_save_string(mpc_save_t *s, const char *x) {
+  mpc_save_int(s, x ? (int)strlen(x) : -1);
+  if (x) { mpc_save_bytes(s, x, strlen(x)); }
+}
+
+static void mpc_save_fn(mpc_save_t *s, mpc_fn_t f) {
+  int j;
+  if (f == NULL) { mpc_save_int(s, -1); return; }
+  for (j = 0; j < MPC_SAVE_FNS_NUM; j++) {
+    if (mpc_save_fns[j] == f) { mpc_save_int(s, j); return; }
+  }
+  s->ok = 0;
+}
+
+static int mpc_save_root(mpc_save_t *s, mpc_parser_t *p) {
+  int j;
+  for (j = 0; j < s->n; j++) {
+    if (s->roots[j] == p) { return j; }
+  }
+  s->ok = 0;
+  return 0;
+}
+
+static void mpc_save_head(mpc_save_t *s, mpc_parser_t *p) {
+  mpc_save_int(s, p->type);
+  mpc_save_int(s, p->span);
+  mpc_save_string(s, p->retained ? NULL : p->name);
+}
+
+static int mpc_save_node(mpc_save_t *s, mpc_parser_t *p);
+
+static int mpc_save_child(mpc_save_t *s, mpc_parser_t *p) {
+  return p->retained ? mpc_save_root(s, p) : mpc_save_node(s, p);
+}
+
+/* Saves `p` after its children, returning its index */
+static int mpc_save_node(mpc_save_t *s, mpc_parser_t *p) {
+
+  int j, x = 0, *xs = NULL;
+  mpc_fn_t f;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT:     x = mpc_save_child(s, p->data.expect.x); break;
+    case MPC_TYPE_APPLY:      x = mpc_save_child(s, p->data.apply.x); break;
+    case MPC_TYPE_APPLY_TO:   x = mpc_save_child(s, p->data.apply_to.x); break;
+    case MPC_TYPE_CHECK:      x = mpc_save_child(s, p->data.check.x); break;
+    case MPC_TYPE_CHECK_WITH: x = mpc_save_child(s, p->data.check_with.x); break;
+    case MPC_TYPE_PREDICT:    x = mpc_save_child(s, p->data.predict.x); break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:      x = mpc_save_child(s, p->data.not.x); break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:      x = mpc_save_child(s, p->data.repeat.x); break;
+    case MPC_TYPE_DFA:        x = mpc_save_child(s, p->data.dfa.x); break;
+    case MPC_TYPE_CHARSET:    x = mpc_save_child(s, p->data.charset.x); break;
+
+    case MPC_TYPE_OR:
+      xs = malloc(sizeof(int) * (p->data.or.n + 1));
+      for (j = 0; j < p->data.or.n; j++) { xs[j] = mpc_save_child(s, p->data.or.xs[j]); }
+      break;
+
+    case MPC_TYPE_AND:
+      xs = malloc(sizeof(int) * (p->data.and.n + 1));
+      for (j = 0; j < p->data.and.n; j++) { xs[j] = mpc_save_child(s, p->data.and.xs[j]); }
+      break;
+
+    default: break;
+  }
+
+  mpc_save_head(s, p);
+
+  switch (p->type) {
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      break;
+
+    case MPC_TYPE_FAIL: mpc_save_string(s, p->data.fail.m); break;
+
+    case MPC_TYPE_LIFT: mpc_save_fn(s, (mpc_fn_t)p->data.lift.lf); break;
+    case MPC_TYPE_LIFT_VAL: if (p->data.lift.x) { s->ok = 0; } break;
+
+    case MPC_TYPE_EXPECT:
+      mpc_save_int(s, x);
+      mpc_save_string(s, p->data.expect.m);
+      break;
+
+    case MPC_TYPE_ANCHOR:  mpc_save_fn(s, (mpc_fn_t)p->data.anchor.f); break;
+    case MPC_TYPE_SATISFY: mpc_save_fn(s, (mpc_fn_t)p->data.satisfy.f); break;
+
+    case MPC_TYPE_SINGLE: mpc_save_bytes(s, &p->data.single.x, 1); break;
+    case MPC_TYPE_RANGE:
+      mpc_save_bytes(s, &p->data.range.x, 1);
+      mpc_save_bytes(s, &p->data.range.y, 1);
+      break;
+
+    case MPC_TYPE_STRING: mpc_save_string(s, p->data.string.x); break;
+
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpc_save_string(s, p->data.oneof.x);
+      mpc_save_bytes(s, p->data.oneof.set, sizeof(mpc_charset_t));
+      break;
+
+    case MPC_TYPE_APPLY:
+      mpc_save_int(s, x);
+      mpc_save_fn(s, (mpc_fn_t)p->data.apply.f);
+      break;
+
+    /* Tags are one of mpc's own strings and rule tags point at the rule */
+    case MPC_TYPE_APPLY_TO:
+      mpc_save_int(s, x);
+      f = (mpc_fn_t)p->data.apply_to.f;
+      mpc_save_fn(s, f);
+      if (f == (mpc_fn_t)mpc_ast_tag || f == (mpc_fn_t)mpc_ast_add_tag) {
+        for (j = 0; j < 3; j++) {
+          if (strcmp(p->data.apply_to.d, mpc_save_tags[j]) == 0) { break; }
+        }
+        if (j == 3) { s->ok = 0; }
+        mpc_save_int(s, j);
+      } else if (f == (mpc_fn_t)mpc_ast_add_rule_tag) {
+        mpc_save_int(s, mpc_save_root(s, p->data.apply_to.d));
+      } else if (p->data.apply_to.d) {
+        s->ok = 0;
+      }
+      break;
+
+    case MPC_TYPE_CHECK:
+      mpc_save_int(s, x);
+      mpc_save_fn(s, (mpc_fn_t)p->data.check.dx);
+      mpc_save_fn(s, (mpc_fn_t)p->data.check.f);
+      mpc_save_string(s, p->data.check.e);
+      break;
+
+    case MPC_TYPE_CHECK_WITH:
+      mpc_save_int(s, x);
+      mpc_save_fn(s, (mpc_fn_t)p->data.check_with.dx);
+      mpc_save_fn(s, (mpc_fn_t)p->data.check_with.f);
+      mpc_save_string(s, p->data.check_with.e);
+      if (p->data.check_with.d) { s->ok = 0; }
+      break;
+
+    case MPC_TYPE_PREDICT: mpc_save_int(s, x); break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_save_int(s, x);
+      mpc_save_fn(s, (mpc_fn_t)p->data.not.dx);
+      mpc_save_fn(s, (mpc_fn_t)p->data.not.lf);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_save_int(s, x);
+      mpc_save_int(s, p->data.repeat.n);
+      mpc_save_fn(s, (mpc_fn_t)p->data.repeat.f);
+      mpc_save_fn(s, (mpc_fn_t)p->data.repeat.dx);
+      break;
+
+    case MPC_TYPE_OR:
+      mpc_save_int(s, p->data.or.n);
+      for (j = 0; j < p->data.or.n; j++) { mpc_save_int(s, xs[j]); }
+      break;
+
+    case MPC_TYPE_AND:
+      mpc_save_int(s, p->data.and.n);
+      mpc_save_fn(s, (mpc_fn_t)p->data.and.f);
+      for (j = 0; j < p->data.and.n; j++) { mpc_save_int(s, xs[j]); }
+      for (j = 0; j < p->data.and.n-1; j++) { mpc_save_fn(s, (mpc_fn_t)p->data.and.dxs[j]); }
+      break;
+
+    case MPC_TYPE_DFA:
+      mpc_save_int(s, x);
+      mpc_save_int(s, p->data.dfa.n);
+      mpc_save_bytes(s, p->data.dfa.table, p->data.dfa.n * 256);
+      mpc_save_bytes(s, p->data.dfa.accept, p->data.dfa.n);
+      break;
+
+    case MPC_TYPE_CHARSET:
+      mpc_save_int(s, x);
+      mpc_save_bytes(s, p->data.charset.set, sizeof(mpc_charset_t));
+      break;
+
+    default: s->ok = 0; break;
+  }
+
+  free(xs);
+  return s->n + s->nodes_num++;
+}
+
+static int mpc_save_st(FILE *f, int flags, const char *language, int n, mpc_parser_t **roots) {
+
+  int j, *defs;
+  mpc_save_t s;
+
+  s.f = f;
+  s.n = n;
+  s.roots = roots;
+  s.nodes_num = 0;
+  s.check = 2166136261UL;
+  s.ok = 1;
+
+  for (j = 0; j < n; j++) {
+    if (roots[j] == NULL || !roots[j]->retained) { return 0; }
+  }
+
+  mpc_save_bytes(&s, mpc_save_magic, sizeof(mpc_save_magic));
+  mpc_save_int(&s, MPC_SAVE_VERSION);
+  mpc_save_int(&s, MPC_SAVE_FNS_NUM);
+  mpc_save_int(&s, flags);
+  mpc_save_string(&s, language);
+  mpc_save_int(&s, n);
+  for (j = 0; j < n; j++) { mpc_save_string(&s, roots[j]->name); }
+
+  defs = malloc(sizeof(int) * (n + 1));
+  for (j = 0; j < n; j++) {
+    defs[j] = roots[j]->type == MPC_TYPE_UNDEFINED ? -1 : mpc_save_node(&s, roots[j]);
+  }
+  mpc_save_int(&s, -1);
+
+  for (j = 0; j < n; j++) {
+    mpc_save_int(&s, defs[j]);
+    mpc_save_int(&s, roots[j]->memo | (roots[j]->arena << 1) | (roots[j]->tag_ids << 2) | (roots[j]->lazy << 3));
+  }
+  mpc_save_int(&s, (int)s.check);
+
+  free(defs);
+  return s.ok;
+}
+
+int mpc_save(FILE *f, int n, ...) {
+  int j, x;
+  mpc_parser_t **roots = malloc(sizeof(mpc_parser_t*) * (n + 1));
+  va_list va;
+  va_start(va, n);
+  for (j = 0; j < n; j++) { roots[j] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
+  x = mpc_save_st(f, 0, NULL, n, roots);
+  free(roots);
+  return x;
+}
+
+/*
+** The saved grammar is read in whole and first
+** checked without building anything, so that a
+** stale or damaged file leaves the parsers as they
+** were and nothing needs to be torn down.
+*/
+
+typedef struct {
+  char *data;
+  long pos;
+  long length;
+  int n;
+  mpc_parser_t **roots;
+  va_list *va;
+  int nodes_num;
+  int nodes_slots;
+  mpc_parser_t **nodes;
+  char *owned;
+  int build;
+  int ok;
+} mpc_load_t;
+
+static const char *mpc_load_bytes(mpc_load_t *l, long n) {
+  const char *x = l->data + l->pos;
+  if (n < 0 || n > l->length - l->pos) { l->ok = 0; l->pos = l->length; return NULL; }
+  l->pos += n;
+  return x;
+}
+
+static int mpc_load_int(mpc_load_t *l) {
+  int x = 0;
+  const char *b = mpc_load_bytes(l, sizeof(int));
+  if (b) { memcpy(&x, b, sizeof(int)); }
+  return x;
+}
+
+static char mpc_load_char(mpc_load_t *l) {
+  const char *b = mpc_load_bytes(l, 1);
+  return b ? *b : '\0';
+}
+
+static char *mpc_load_string(mpc_load_t *l) {
+  char *y;
+  int n = mpc_load_int(l);
+  const char *x = n == -1 ? NULL : mpc_load_bytes(l, n);
+  if (x == NULL || !l->build) { return NULL; }
+  y = malloc(n + 1);
+  memcpy(y, x, n);
+  y[n] = '\0';
+  return y;
+}
+
+static int mpc_load_string_eq(mpc_load_t *l, const char *s) {
+  int n = mpc_load_int(l);
+  const char *x = n == -1 ? NULL : mpc_load_bytes(l, n);
+  if (x == NULL || s == NULL) { return x == NULL && s == NULL && l->ok; }
+  return (size_t)n == strlen(s) && memcmp(x, s, n) == 0;
+}
+
+static void mpc_load_set(mpc_load_t *l, mpc_charset_t set) {
+  const char *b = mpc_load_bytes(l, sizeof(mpc_charset_t));
+  if (b && l->build) { memcpy(set, b, sizeof(mpc_charset_t)); }
+}
+
+static mpc_fn_t mpc_load_fn(mpc_load_t *l) {
+  int j = mpc_load_int(l);
+  if (j == -1) { return NULL; }
+  if (j < 0 || j >= MPC_SAVE_FNS_NUM) { l->ok = 0; return NULL; }
+  return mpc_save_fns[j];
+}
+
+static mpc_parser_t *mpc_load_root(mpc_load_t *l) {
+  int j = mpc_load_int(l);
+  if (j < 0 || j >= l->n) { l->ok = 0; return NULL; }
+  return l->roots[j];
+}
+
+/* Each parser saved belongs to exactly one other */
+static mpc_parser_t *mpc_load_child(mpc_load_t *l) {
+  int j = mpc_load_int(l);
+  if (j >= 0 && j < l->n) { return l->roots[j]; }
+  if (j < 0 || j - l->n >= l->nodes_num || l->owned[j - l->n]) { l->ok = 0; return NULL; }
+  j -= l->n;
+  l->owned[j] = 1;
+  return l->nodes[j];
+}
+
+static void mpc_load_node(mpc_load_t *l, int type) {
+
+  int j, n;
+  mpc_parser_t *p = l->build ? mpc_undefined() : NULL;
+  mpc_pdata_t d;
+  mpc_fn_t f;
+  const char *b;
+
+  memset(&d, 0, sizeof(mpc_pdata_t));
+  n = mpc_load_int(l);
+  if (p) { p->span = n; p->name = mpc_load_string(l); } else { mpc_load_string(l); }
+
+  switch (type) {
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+    case MPC_TYPE_LIFT_VAL:
+      break;
+
+    case MPC_TYPE_FAIL: d.fail.m = mpc_load_string(l); break;
+    case MPC_TYPE_LIFT: d.lift.lf = (mpc_ctor_t)mpc_load_fn(l); break;
+
+    case MPC_TYPE_EXPECT:
+      d.expect.x = mpc_load_child(l);
+      d.expect.m = mpc_load_string(l);
+      break;
+
+    case MPC_TYPE_ANCHOR:  d.anchor.f = (int(*)(char,char))mpc_load_fn(l); break;
+    case MPC_TYPE_SATISFY: d.satisfy.f = (int(*)(char))mpc_load_fn(l); break;
+
+    case MPC_TYPE_SINGLE: d.single.x = mpc_load_char(l); break;
+    case MPC_TYPE_RANGE:
+      d.range.x = mpc_load_char(l);
+      d.range.y = mpc_load_char(l);
+      break;
+
+    case MPC_TYPE_STRING: d.string.x = mpc_load_string(l); break;
+
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      d.oneof.x = mpc_load_string(l);
+      mpc_load_set(l, d.oneof.set);
+      break;
+
+    case MPC_TYPE_APPLY:
+      d.apply.x = mpc_load_child(l);
+      d.apply.f = (mpc_apply_t)mpc_load_fn(l);
+      break;
+
+    case MPC_TYPE_APPLY_TO:
+      d.apply_to.x = mpc_load_child(l);
+      f = mpc_load_fn(l);
+      d.apply_to.f = (mpc_apply_to_t)f;
+      if (f == (mpc_fn_t)mpc_ast_tag || f == (mpc_fn_t)mpc_ast_add_tag) {
+        j = mpc_load_int(l);
+        if (j < 0 || j >= 3) { l->ok = 0; break; }
+        d.apply_to.d = (void*)mpc_save_tags[j];
+      } else if (f == (mpc_fn_t)mpc_ast_add_rule_tag) {
+        d.apply_to.d = mpc_load_root(l);
+      }
+      break;
+
+    case MPC_TYPE_CHECK:
+      d.check.x = mpc_load_child(l);
+      d.check.dx = (mpc_dtor_t)mpc_load_fn(l);
+      d.check.f = (mpc_check_t)mpc_load_fn(l);
+      d.check.e = mpc_load_string(l);
+      break;
+
+    case MPC_TYPE_CHECK_WITH:
+      d.check_with.x = mpc_load_child(l);
+      d.check_with.dx = (mpc_dtor_t)mpc_load_fn(l);
+      d.check_with.f = (mpc_check_with_t)mpc_load_fn(l);
+      d.check_with.e = mpc_load_string(l);
+      break;
+
+    case MPC_TYPE_PREDICT: d.predict.x = mpc_load_child(l); break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      d.not.x = mpc_load_child(l);
+      d.not.dx = (mpc_dtor_t)mpc_load_fn(l);
+      d.not.lf = (mpc_ctor_t)mpc_load_fn(l);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      d.repeat.x = mpc_load_child(l);
+      d.repeat.n = mpc_load_int(l);
+      d.repeat.f = (mpc_fold_t)mpc_load_fn(l);
+      d.repeat.dx = (mpc_dtor_t)mpc_load_fn(l);
+      break;
+
+    case MPC_TYPE_OR:
+      d.or.n = mpc_load_int(l);
+      if (d.or.n < 0 || d.or.n > l->length) { l->ok = 0; break; }
+      d.or.xs = l->build ? malloc(sizeof(mpc_parser_t*) * (d.or.n + 1)) : NULL;
+      for (j = 0; j < d.or.n; j++) {
+        if (d.or.xs) { d.or.xs[j] = mpc_load_child(l); } else { mpc_load_child(l); }
+      }
+      break;
+
+    case MPC_TYPE_AND:
+      d.and.n = mpc_load_int(l);
+      if (d.and.n < 1 || d.and.n > l->length) { l->ok = 0; break; }
+      d.and.f = (mpc_fold_t)mpc_load_fn(l);
+      d.and.xs = l->build ? malloc(sizeof(mpc_parser_t*) * d.and.n) : NULL;
+      d.and.dxs = l->build ? malloc(sizeof(mpc_dtor_t) * d.and.n) : NULL;
+      for (j = 0; j < d.and.n; j++) {
+        if (d.and.xs) { d.and.xs[j] = mpc_load_child(l); } else { mpc_load_child(l); }
+      }
+      for (j = 0; j < d.and.n-1; j++) {
+        f = mpc_load_fn(l);
+        if (d.and.dxs) { d.and.dxs[j] = (mpc_dtor_t)f; }
+      }
+      break;
+
+    case MPC_TYPE_DFA:
+      d.dfa.x = mpc_load_child(l);
+      d.dfa.n = mpc_load_int(l);
+      if (d.dfa.n < 1 || d.dfa.n > l->length / 256) { l->ok = 0; break; }
+      b = mpc_load_bytes(l, d.dfa.n * 256L);
+      if (b && l->build) {
+        d.dfa.table = malloc(d.dfa.n * 256);
+        memcpy(d.dfa.table, b, d.dfa.n * 256);
+      }
+      b = mpc_load_bytes(l, d.dfa.n);
+      if (b && l->build) {
+        d.dfa.accept = malloc(d.dfa.n);
+        memcpy(d.dfa.accept, b, d.dfa.n);
+      }
+      break;
+
+    case MPC_TYPE_CHARSET:
+      d.charset.x = mpc_load_child(l);
+      mpc_load_set(l, d.charset.set);
+      break;
+
+    default: l->ok = 0; break;
+  }
+
+  if (l->nodes_num == l->nodes_slots) {
+    l->nodes_slots = l->nodes_slots * 2 + 16;
+    l->nodes = realloc(l->nodes, sizeof(mpc_parser_t*) * l->nodes_slots);
+    l->owned = realloc(l->owned, l->nodes_slots);
+  }
+
+  if (p) {
+    p->type = type;
+    p->data = d;
+  }
+
+  l->nodes[l->nodes_num] = p;
+  l->owned[l->nodes_num] = 0;
+  l->nodes_num++;
+}
+
+static const char *mpc_load_check(mpc_load_t *l) {
+
+  unsigned int check;
+
+  if (l->length < (long)(sizeof(mpc_save_magic) + sizeof(int))
+  ||  memcmp(l->data, mpc_save_magic, sizeof(mpc_save_magic)) != 0) { return "Not a saved grammar!"; }
+
+  l->length -= sizeof(int);
+  memcpy(&check, l->data + l->length, sizeof(int));
+  if (check != mpc_save_check(2166136261UL, l->data, l->length)) { return "Saved grammar is damaged!"; }
+
+  return NULL;
+}
+
+static const char *mpc_load_run(mpc_load_t *l, const int *flags, const char *language) {
+
+  int j, k, type;
+  mpc_parser_t *p;
+  mpc_predict_group_t *g;
+
+  l->pos = sizeof(mpc_save_magic);
+  l->nodes_num = 0;
+  l->ok = 1;
+
+  if (mpc_load_int(l) != MPC_SAVE_VERSION
+  ||  mpc_load_int(l) != MPC_SAVE_FNS_NUM) { return "Saved grammar is from another version of mpc!"; }
+
+  j = mpc_load_int(l);
+  if (flags && (j != *flags || !mpc_load_string_eq(l, language))) {
+    return "Saved grammar is for a different language!";
+  } else if (!flags) {
+    mpc_load_string_eq(l, NULL);
+  }
+
+  /* Parsers passed like `mpca_lang` are taken as many as were saved */
+  j = mpc_load_int(l);
+  if (l->va && l->roots == NULL && j >= 0 && j <= l->length) {
+    l->n = j;
+    l->roots = malloc(sizeof(mpc_parser_t*) * (j + 1));
+    for (k = 0; k < j; k++) {
+      l->roots[k] = va_arg(*l->va, mpc_parser_t*);
+      if (l->roots[k] == NULL) { l->n = k; break; }
+    }
+  }
+
+  if (j != l->n) { return "Saved grammar is for different parsers!"; }
+  for (j = 0; j < l->n; j++) {
+    if (!mpc_load_string_eq(l, l->roots[j]->name)) { return "Saved grammar is for different parsers!"; }
+  }
+
+  while (l->ok && (type = mpc_load_int(l)) != -1) { mpc_load_node(l, type); }
+
+  for (j = 0; j < l->n && l->ok; j++) {
+
+    /* The index of its definition, if it has one */
+    k = mpc_load_int(l);
+    if (k != -1 && (k < l->n || k - l->n >= l->nodes_num || l->owned[k - l->n])) { l->ok = 0; break; }
+    if (k != -1) { k -= l->n; l->owned[k] = 1; }
+
+    p = l->roots[j];
+    type = mpc_load_int(l);
+    if (l->build && l->ok && k != -1) {
+      mpc_define(p, l->nodes[k]);
+      p->memo = type & 1;
+      p->arena = (type >> 1) & 1;
+      p->tag_ids = (type >> 2) & 1;
+      p->lazy = (type >> 3) & 1;
+    }
+  }
+
+  for (j = 0; j < l->nodes_num; j++) {
+    if (!l->owned[j]) { l->ok = 0; }
+  }
+
+  if (!l->ok) { return "Saved grammar is damaged!"; }
+
+  if (l->build) {
+    g = mpc_predict_group_new();
+    for (j = 0; j < l->n; j++) { mpc_predict_unretained(l->roots[j], 1, g); }
+    mpc_predict_group_release(g);
+  }
+
+  return NULL;
+}
+
+static mpc_err_t *mpc_load_st(FILE *f, const char *filename, const int *flags, const char *language,
+  int n, mpc_parser_t **roots, va_list *va) {
+
+  size_t m;
+  const char *failure;
+  mpc_load_t l;
+
+  l.length = 0;
+  l.data = malloc(MPC_INPUT_BLOCK);
+  while ((m = fread(l.data + l.length, 1, MPC_INPUT_BLOCK, f)) > 0) {
+    l.length += m;
+    l.data = realloc(l.data, l.length + MPC_INPUT_BLOCK);
+  }
+
+  l.n = n;
+  l.roots = roots;
+  l.va = va;
+  l.nodes_slots = 0;
+  l.nodes = NULL;
+  l.owned = NULL;
+
+  l.build = 0;
+  failure = mpc_load_check(&l);
+  if (failure == NULL) { failure = mpc_load_run(&l, flags, language); }
+  if (failure == NULL) {
+    l.build = 1;
+    mpc_load_run(&l, flags, language);
+  }
+
+  if (l.roots != roots) { free(l.roots); }
+  free(l.data);
+  free(l.nodes);
+  free(l.owned);
+  return failure ? mpc_err_file(filename, failure) : NULL;
+}
+
+mpc_err_t *mpc_load(FILE *f, int n, ...) {
+  int j;
+  mpc_err_t *err;
+  mpc_parser_t **roots = malloc(sizeof(mpc_parser_t*) * (n + 1));
+  va_list va;
+  va_start(va, n);
+  for (j = 0; j < n; j++) { roots[j] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
+  err = mpc_load_st(f, "<mpc_load>", NULL, NULL, n, roots, NULL);
+  free(roots);
+  return err;
+}
+
+/*
+** Like `mpca_lang` but keeps the grammar it builds
+** in the file `cache`, and uses that instead when
+** it was built from the same language and flags.
+** The parsers are passed in the same way. Grammars
+** that can't be saved are just built every time.
+*/
+
+mpc_err_t *mpca_lang_cache(int flags, const char *cache, const char *language, ...) {
+
+  int j;
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+  FILE *f;
+
+  va_list va;
+
+  f = fopen(cache, "rb");
+  if (f) {
+    va_start(va, language);
+    err = mpc_load_st(f, cache, &flags, language, 0, NULL, &va);
+    va_end(va);
+    fclose(f);
+    if (err == NULL) { return NULL; }
+    mpc_err_delete(err);
+  }
+
+  va_start(va, language);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  i = mpc_input_new_string("<mpca_lang>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  if (err == NULL) {
+    f = fopen(cache, "wb");
+    if (f) {
+      j = mpc_save_st(f, flags, language, st.parsers_num, st.parsers);
+      fclose(f);
+      if (!j) { remove(cache); }
+    }
+  }
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
 static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
 
   int i, total;
@@ -3842,6 +6055,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->retained && !force) { return 0; }
 
   if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_DFA)    { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_CHARSET) { return 1 + mpc_nodecount_unretained(p->data.charset.x, 0); }
 
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
@@ -3883,6 +6098,127 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
+/*
+** Whether the output of `p` is always just the input
+** it consumed, so on a string it can be taken from the
+** input in one go rather than built up and folded.
+*/
+
+static int mpc_optimise_span_of(mpc_parser_t *p) {
+  return !p->retained && p->span;
+}
+
+static int mpc_optimise_span(mpc_parser_t *p) {
+
+  int i;
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_STRING:
+    case MPC_TYPE_DFA:
+    case MPC_TYPE_CHARSET:
+      return 1;
+
+    case MPC_TYPE_LIFT:   return p->data.lift.lf == mpcf_ctor_str;
+    case MPC_TYPE_EXPECT: return mpc_optimise_span_of(p->data.expect.x);
+    case MPC_TYPE_MAYBE:  return p->data.not.lf == mpcf_ctor_str && mpc_optimise_span_of(p->data.not.x);
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.f == mpcf_strfold && mpc_optimise_span_of(p->data.repeat.x);
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      for (i = 0; i < p->data.and.n; i++) {
+        if (!mpc_optimise_span_of(p->data.and.xs[i])) { return 0; }
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_optimise_span_of(p->data.or.xs[i])) { return 0; }
+      }
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+/* The characters accepted by a parser that matches exactly one */
+static int mpc_optimise_charset_of(mpc_parser_t *p, mpc_charset_t s) {
+  if (p->retained) { return 0; }
+  if (p->type == MPC_TYPE_EXPECT) { p = p->data.expect.x; }
+  return !p->retained && mpc_charset_of(p, s);
+}
+
+/*
+** Merges a run of single character alternatives
+** in `or` into one lookup. The alternatives are
+** kept to be run instead when errors are needed.
+*/
+
+static int mpc_optimise_or_charset(mpc_parser_t *p) {
+
+  int j, k, l, m;
+  mpc_charset_t s, set;
+  mpc_parser_t *t, *c;
+
+  for (j = 0; j < p->data.or.n; j = k + 1) {
+
+    memset(set, 0, sizeof(mpc_charset_t));
+    for (k = j; k < p->data.or.n && mpc_optimise_charset_of(p->data.or.xs[k], s); k++) {
+      mpc_charset_union(set, s);
+    }
+    if (k - j < 2) { continue; }
+
+    /* Alternatives of an already merged run are taken out of it */
+    t = mpc_undefined();
+    t->type = MPC_TYPE_OR;
+    t->data.or.n = 0;
+    t->data.or.xs = NULL;
+    for (l = j; l < k; l++) {
+      c = p->data.or.xs[l];
+      m = c->type == MPC_TYPE_CHARSET ? c->data.charset.x->data.or.n : 1;
+      t->data.or.xs = realloc(t->data.or.xs, sizeof(mpc_parser_t*) * (t->data.or.n + m));
+      if (c->type == MPC_TYPE_CHARSET) {
+        memcpy(t->data.or.xs + t->data.or.n, c->data.charset.x->data.or.xs, m * sizeof(mpc_parser_t*));
+        free(c->data.charset.x->data.or.xs); mpc_or_first_delete(c->data.charset.x); free(c->data.charset.x);
+        free(c->name); free(c);
+      } else {
+        t->data.or.xs[t->data.or.n] = c;
+      }
+      t->data.or.n += m;
+    }
+
+    mpc_or_first_delete(p);
+
+    if (j == 0 && k == p->data.or.n) {
+      free(p->data.or.xs);
+      c = p;
+    } else {
+      c = mpc_undefined();
+      p->data.or.xs[j] = c;
+      memmove(p->data.or.xs + j + 1, p->data.or.xs + k, (p->data.or.n - k) * sizeof(mpc_parser_t*));
+      p->data.or.n -= k - j - 1;
+    }
+
+    c->type = MPC_TYPE_CHARSET;
+    c->data.charset.x = t;
+    memcpy(c->data.charset.set, set, sizeof(mpc_charset_t));
+    return 1;
+  }
+
+  return 0;
+}
+
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
 
   int i, n, m;
@@ -3893,6 +6229,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   /* Optimise Subexpressions */
 
   if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_DFA)        { mpc_optimise_unretained(p->data.dfa.x, 0); }
   if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
@@ -3929,7 +6266,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      mpc_or_first_delete(p);
+      free(t->data.or.xs); mpc_or_first_delete(t); free(t->name); free(t);
       continue;
     }
 
@@ -3943,10 +6281,14 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      mpc_or_first_delete(p);
+      free(t->data.or.xs); mpc_or_first_delete(t); free(t->name); free(t);
       continue;
     }
 
+    /* Merge single character `or` */
+    if (p->type == MPC_TYPE_OR && mpc_optimise_or_charset(p)) { continue; }
+
     /* Remove ast `pass` */
     if (p->type == MPC_TYPE_AND
     &&  p->data.and.n == 2
@@ -4046,10 +6388,12 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
-    return;
+    break;
 
   }
 
+  p->span = mpc_optimise_span(p);
+
 }
 
 void mpc_optimise(mpc_parser_t *p) {
@@ -73,6 +73,34 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Pipes are read a character at a time, and the
+** character looked at past the end of the parse
+** is put back, so the next parse of the same pipe
+** starts where this one stopped. A parse that gave
+** back more than one character by backtracking
+** leaves the rest read, so don't parse that pipe
+** again. Files are seeked back to where the parse
+** stopped.
+*/
+
+/*
+** Parsing only reads the parser. Prediction tables
+** are built by `mpca_lang` and never rebuilt while
+** parsing, and packrat memos and AST arenas belong
+** to a single parse, so once built the same parser
+** can be used by any number of threads at once,
+** each with its own input. Other grammars can be
+** built, redefined and cleaned up meanwhile, but
+** no rule of a grammar being parsed may be changed
+** with `mpc_define` or `mpc_undefine` until those
+** parses have finished. Tag ids are kept in one
+** table for every grammar, so ask for them with
+** `mpc_tag_id`, and delete rules that have them,
+** from one thread at a time and not while parsing
+** with grammars that use them.
+*/
+
 /*
 ** Function Types
 */
@@ -282,12 +310,42 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode);
 ** AST
 */
 
+/*
+** Besides the tag string, each AST node keeps a
+** bitset of tag ids so tags can be tested without
+** searching the string. A rule gets an id from
+** `mpc_tag_id` the first time it is asked for, and
+** keeps it until it is deleted, so no two rules
+** share one even in different grammars. Only rules
+** with an id put it on the nodes they parse, so ask
+** for ids before parsing and before starting any
+** threads. Once `MPC_TAG_MAX` ids are in use it
+** returns -1. Grammars made with MPCA_LANG_TAG_IDS
+** leave rule names out of the tag strings.
+*/
+
+typedef unsigned long mpc_tags_t;
+
+enum {
+  MPC_TAG_ROOT   = 0,
+  MPC_TAG_REGEX  = 1,
+  MPC_TAG_STRING = 2,
+  MPC_TAG_CHAR   = 3,
+  MPC_TAG_RULE   = 4
+};
+
+#define MPC_TAG_MAX ((int)(sizeof(mpc_tags_t) * 8))
+#define MPC_TAG_BIT(id) ((id) >= 0 && (id) < MPC_TAG_MAX ? ((mpc_tags_t)1 << (id)) : (mpc_tags_t)0)
+
 typedef struct mpc_ast_t {
   char *tag;
+  mpc_tags_t tags;
   char *contents;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  struct mpc_ast_arena_t *arena;
+  int shared;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -299,6 +357,9 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
+int mpc_tag_id(mpc_parser_t *p);
+int mpc_ast_has_tag(mpc_ast_t *a, int id);
+
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
@@ -355,15 +416,38 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4,
+  MPCA_LANG_ARENA                = 8,
+  MPCA_LANG_TAG_IDS              = 16,
+  MPCA_LANG_LAZY_ERRORS          = 32
 };
 
+/*
+** Strings parsed with rules of a grammar made with
+** MPCA_LANG_LAZY_ERRORS build no errors on the way
+** and may use compiled regexes and prediction. If
+** such a parse fails the string is parsed again to
+** build the error, so every callback it reached,
+** including those of parsers passed in to the
+** grammar, may run twice. Only use it when they can.
+** Other parses run each callback once.
+*/
+
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
 
 mpc_err_t *mpca_lang(int flags, const char *language, ...);
 mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
+mpc_err_t *mpca_lang_cache(int flags, const char *cache, const char *language, ...);
+
+/*
+** Saved Grammars
+*/
+
+int mpc_save(FILE *f, int n, ...);
+mpc_err_t *mpc_load(FILE *f, int n, ...);
 
 /*
 ** Misc
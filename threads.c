@@ -0,0 +1,170 @@
+// Stress test for sharing one Lispy parser between threads, as mpc.h allows
+
+/* clock_gettime is POSIX, which -std=c99 leaves undeclared unless asked for */
+#define _POSIX_C_SOURCE 200809L
+
+#include "mpc.h"
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+/* Atoms that random inputs are made from */
+static const char* atoms[] = { "12", "-3.5", "x", "foo", "+", "def", "head", "==" };
+
+mpc_parser_t* Lispy;
+int parses = 1000;
+
+unsigned long next_random(unsigned long* x){
+    *x = *x * 6364136223846793005UL + 1442695040888963407UL;
+    return *x >> 33;
+}
+
+/* Writes a random expression nested at most depth deep to p, returning the end of it */
+char* make_expr(unsigned long* x, char* p, int depth){
+    unsigned long r = next_random(x) % 8;
+    if(depth == 0 || r < 5){
+        const char* a = atoms[next_random(x) % (sizeof(atoms) / sizeof(atoms[0]))];
+        strcpy(p, a);
+        return p + strlen(a);
+    }
+    *p++ = r == 7 ? '{' : '(';
+    int n = next_random(x) % 5;
+    for(int i = 0; i < n; i++){
+        p = make_expr(x, p, depth - 1);
+        *p++ = next_random(x) % 4 ? ' ' : '\n';
+    }
+    *p++ = r == 7 ? '}' : ')';
+    return p;
+}
+
+/* Fills buf with the random input numbered n, so that every thread can make any input without sharing a generator.
+   One in four has a character swapped for one that can't be parsed, so errors are checked as well */
+void make_input(unsigned long n, char* buf){
+    unsigned long x = n * 2654435761UL + 1;
+    int count = 1 + n % 4;
+    char* p = buf;
+    for(int i = 0; i < count; i++){
+        p = make_expr(&x, p, 4);
+        *p++ = ' ';
+    }
+    *p = '\0';
+    if(n % 4 == 3){ buf[next_random(&x) % (p - buf)] = n % 8 == 3 ? '#' : '"'; }
+}
+
+unsigned long hash_string(const char* s, unsigned long h){
+    while(*s){ h = h * 31 + (unsigned char)*s++; }
+    return h;
+}
+
+/* Hashes everything in the tree, positions included, so two parses only match if they built the same tree */
+unsigned long hash_ast(mpc_ast_t* a, unsigned long h){
+    h = hash_string(a->tag, h);
+    h = hash_string(a->contents, h);
+    h = h * 31 + a->state.pos;
+    for(int i = 0; i < a->children_num; i++){ h = hash_ast(a->children[i], h); }
+    return h;
+}
+
+/* Parses input n and returns the hash of its tree, or of its error message if it failed */
+unsigned long parse_one(unsigned long n){
+    char buf[8192];
+    mpc_result_t r;
+    unsigned long h;
+    make_input(n, buf);
+    if(mpc_parse("<stress>", buf, Lispy, &r)){
+        h = hash_ast(r.output, 1);
+        mpc_ast_delete(r.output);
+    } else{
+        char* err = mpc_err_string(r.error);
+        h = hash_string(err, 2);
+        free(err);
+        mpc_err_delete(r.error);
+    }
+    return h;
+}
+
+typedef struct {
+    int index;
+    int threads;
+    unsigned long* expected;
+    long mismatches;
+} worker;
+
+/* Thread t parses inputs t, t + threads, t + 2 * threads and so on, so together they parse the same inputs as one thread */
+void* run_worker(void* arg){
+    worker* w = arg;
+    for(long k = 0; k < parses; k++){
+        unsigned long n = k * w->threads + w->index;
+        if(parse_one(n) != w->expected[n]){ w->mismatches++; }
+    }
+    return NULL;
+}
+
+double seconds_since(struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv){
+
+    int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2){ parses = atoi(argv[2]); }
+    if(max_threads < 1 || max_threads > MAX_THREADS || parses < 1){
+        fprintf(stderr, "Usage: %s [threads, 1 to %d] [parses per thread]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    mpc_parser_t* Number = mpc_new("number");
+    mpc_parser_t* Symbol = mpc_new("symbol");
+    mpc_parser_t* Sexpr  = mpc_new("sexpr");
+    mpc_parser_t* Qexpr  = mpc_new("qexpr");
+    mpc_parser_t* Expr   = mpc_new("expr");
+    Lispy                = mpc_new("lispy");
+
+    /* The same grammar and flags as variables.c */
+    mpca_lang(MPCA_LANG_ARENA | MPCA_LANG_TAG_IDS | MPCA_LANG_LAZY_ERRORS,
+        "                                                     \
+          number   : /-?[0-9]+((\\.)[0-9]+)?/ ;               \
+          symbol   : /[a-zA-Z0-9_+\\-*\\/^%\\\\=<>!&]+/ ;       \
+          sexpr    : '(' <expr>* ')' ;                        \
+          qexpr    : '{' <expr>* '}' ;                        \
+          expr     : <number> | <symbol> | <sexpr> | <qexpr> ;\
+          lispy    : /^/ <expr>* /$/ ;                        \
+        ",
+        Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+
+    /* Results of a single threaded run, which every run after it must match */
+    unsigned long total = (unsigned long)parses * max_threads;
+    unsigned long* expected = malloc(sizeof(unsigned long) * total);
+    for(unsigned long n = 0; n < total; n++){ expected[n] = parse_one(n); }
+
+    pthread_t ids[MAX_THREADS];
+    worker workers[MAX_THREADS];
+    long mismatches = 0;
+
+    printf("threads  parses/s  mismatches\n");
+    /* Doubles the threads each run, finishing on max_threads */
+    for(int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int t = 0; t < threads; t++){
+            workers[t] = (worker){t, threads, expected, 0};
+            pthread_create(&ids[t], NULL, run_worker, &workers[t]);
+        }
+        long run_mismatches = 0;
+        for(int t = 0; t < threads; t++){
+            pthread_join(ids[t], NULL);
+            run_mismatches += workers[t].mismatches;
+        }
+        double elapsed = seconds_since(&start);
+        printf("%7d  %8.0f  %10ld\n", threads, (double)parses * threads / elapsed, run_mismatches);
+        mismatches += run_mismatches;
+        if(threads == max_threads){ break; }
+    }
+
+    free(expected);
+    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    return mismatches ? 1 : 0;
+}
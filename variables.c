@@ -1,6 +1,10 @@
 // Reference: https://buildyourownlisp.com/chapter11_variables
 
+/* fileno and posix_madvise are POSIX, which -std=c99 leaves undeclared unless asked for */
+#define _POSIX_C_SOURCE 200809L
+
 #include "mpc.h"
+#include <limits.h>
 
 #ifdef _WIN32
 
@@ -20,6 +24,11 @@ void add_history(char* unused) {}
 #else
 #include <editline/readline.h>
 #include <editline/history.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #endif
 
 /* Forward delcarations */
@@ -29,7 +38,7 @@ typedef struct lval lval;
 typedef struct lenv lenv;
 
 /* Lisp value */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_RANGE };
 
 /* Array of builtins and current number of builtins (global, not sure if this is good practice) */
 char** builtins;
@@ -38,6 +47,23 @@ int builtins_count = 0;
 /* Global variable for while loop (not sure if good practice) */
 int while_var = 1;
 
+/* Whether input is read with the direct reader instead of mpc, chosen at startup with --reader=direct */
+int direct_reader = 0;
+
+/* Number of worker threads, set with --jobs=N, that large files are read on and long lists are sorted on. At most MAX_JOBS */
+#define MAX_JOBS 64
+int parse_jobs = 1;
+
+/* Parser for whole programs, global so 'load' can use it (not sure if good practice) */
+mpc_parser_t* lispy_parser;
+
+/* Tag ids of the grammar rules, so 'lval_read' can test tag bits instead of searching tag strings */
+int tag_number;
+int tag_symbol;
+int tag_sexpr;
+int tag_qexpr;
+mpc_tags_t tags_expr;
+
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
 /* Struct declarations */
@@ -56,6 +82,10 @@ struct lval {
     /* Count and Pointer to a list of "lval*" */
     int count;
     lval** cell;
+
+    /* Range types hold 'len' numbers starting at 'num' and counting up by 'step' (len is -1 if infinite) */
+    long step;
+    long len;
 };
 
 /* Declare new lenv (Lispy environment) struct */
@@ -108,6 +138,16 @@ lval* lval_sym(char* s){
     return v;
 }
 
+/* Construct a pointer to a new Symbol lval from the first 'n' characters of 's' */
+lval* lval_sym_n(const char* s, long n){
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SYM;
+    v->sym = malloc(n + 1);
+    memcpy(v->sym, s, n);
+    v->sym[n] = '\0';
+    return v;
+}
+
 /* Construct a pointer to a new Function lval */
 lval* lval_fun(lbuiltin func){
     lval* v = malloc(sizeof(lval));
@@ -134,6 +174,34 @@ lval* lval_qexpr(void){
     return v;
 }
 
+/* Construct a pointer to a new lazy Range lval */
+lval* lval_range(long start, long step, long len){
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_RANGE;
+    v->num = start;
+    v->step = step;
+    v->len = len;
+    return v;
+}
+
+/* Returns how many numbers of the Range 'v', counting from its start, fit in a long. Only an infinite Range can run out
+   this way, as 'range' never counts past its end. Distances are worked out as unsigned longs, which can't overflow */
+unsigned long lval_range_fit(lval* v){
+    unsigned long stride = v->step < 0 ? -(unsigned long) v->step : (unsigned long) v->step;
+    unsigned long room = v->step < 0 ? (unsigned long) v->num - (unsigned long) LONG_MIN : (unsigned long) LONG_MAX - (unsigned long) v->num;
+    return room / stride + 1;
+}
+
+/* Sets 'x' to the number at index 'i' of the Range 'v' and returns 1, or returns 0 if that number doesn't fit in a long */
+int lval_range_at(lval* v, long i, long* x){
+    if(i < 0 || (unsigned long) i >= lval_range_fit(v)){
+        return 0;
+    }
+    unsigned long offset = (unsigned long) i * (v->step < 0 ? -(unsigned long) v->step : (unsigned long) v->step);
+    *x = (long) (v->step < 0 ? (unsigned long) v->num - offset : (unsigned long) v->num + offset);
+    return 1;
+}
+
 /* Construct a new lenv */
 lenv* lenv_new(void){
     lenv* e = malloc(sizeof(lenv));
@@ -151,6 +219,7 @@ void lval_del(lval* v){
         /* Do nothing special for number or function types */
         case LVAL_NUM: break;
         case LVAL_FUN: break;
+        case LVAL_RANGE: break;
 
         /* For Err or Sym free the string data */
         case LVAL_ERR:
@@ -213,6 +282,21 @@ void lval_expr_print(lval* v, char open, char close){
     putchar(close);
 }
 
+/* Print a Range as the Q-Expression it stands for, eliding the rest of an infinite one unless it runs out of numbers first */
+void lval_range_print(lval* v){
+    long n = v->len < 0 ? 3 : v->len;
+    long x;
+
+    putchar('{');
+    for(long i=0; i<n && lval_range_at(v, i, &x); i++){
+        printf(i ? " %li" : "%li", x);
+    }
+    if(v->len < 0 && lval_range_at(v, n, &x)){
+        printf(" ...");
+    }
+    putchar('}');
+}
+
 /* Print an "lval" */
 void lval_print(lval* v){
     switch(v->type){
@@ -234,6 +318,9 @@ void lval_print(lval* v){
         case LVAL_QEXPR:
             lval_expr_print(v, '{', '}');
             break;
+        case LVAL_RANGE:
+            lval_range_print(v);
+            break;
     }
 }
 
@@ -268,14 +355,19 @@ lval* lval_copy(lval* v){
         case LVAL_NUM:
             x->num = v->num;
             break;
+        case LVAL_RANGE:
+            x->num = v->num;
+            x->step = v->step;
+            x->len = v->len;
+            break;
 
         /* Copy strings using malloc and strcpy */
         case LVAL_ERR:
-            x->err = malloc(sizeof(v->err) + 1);
+            x->err = malloc(strlen(v->err) + 1);
             strcpy(x->err, v->err);
             break;
         case LVAL_SYM:
-            x->sym = malloc(sizeof(v->sym) + 1);
+            x->sym = malloc(strlen(v->sym) + 1);
             strcpy(x->sym, v->sym);
             break;
 
@@ -353,6 +445,26 @@ void lenv_put(lenv* e, lval* k, lval* v){
     strcpy(e->syms[e->count-1], k->sym);
 }
 
+/* Ranges */
+
+/* Turns a finite Range into the Q-Expression it stands for, in place. Returns an error, and leaves the Range as it was, if it has more elements than a Q-Expression can hold */
+lval* lval_force(lval* v){
+    long len = v->len;
+    if(len > INT_MAX){
+        return lval_err("Range of %li elements is too long to expand.", len);
+    }
+
+    v->type = LVAL_QEXPR;
+    v->count = len;
+    v->cell = malloc(sizeof(lval*) * len);
+    for(long i=0; i<len; i++){
+        long x = 0;
+        lval_range_at(v, i, &x);
+        v->cell[i] = lval_num(x);
+    }
+    return NULL;
+}
+
 /* Builtins */
 
 /* Takes type enumeration as input and returns string representation */
@@ -364,6 +476,7 @@ char* ltype_name(int t){
         case LVAL_FUN: return "Function";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_RANGE: return "Range";
     }
 }
 
@@ -385,15 +498,38 @@ char* ltype_name(int t){
 
 /* Macro for testing whether i-th lval is of the correct type */
 #define INCTYPE(args, i, typ, func) \
-    if (args->cell[0]->type != typ) { \
-        lval* err = lval_err("Function '%s' passed incorrect type for argument 0. Got %s, expected %s.", func, ltype_name(args->cell[0]->type), ltype_name(typ)); \
+    if (args->cell[i]->type != typ) { \
+        lval* err = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected %s.", func, i, ltype_name(args->cell[i]->type), ltype_name(typ)); \
+        lval_del(args); \
+        return err; \
+    }
+
+/* Macro for materializing a Range argument where a Q-Expression is needed */
+#define FORCE(args, i, func) \
+    if (args->cell[i]->type == LVAL_RANGE) { \
+        if (args->cell[i]->len < 0) { \
+            lval* err = lval_err("Function '%s' passed an infinite Range for argument %i.", func, i); \
+            lval_del(args); \
+            return err; \
+        } \
+        lval* err = lval_force(args->cell[i]); \
+        if (err) { \
+            lval_del(args); \
+            return err; \
+        } \
+    }
+
+/* Macro for testing whether the i-th argument is a Q-Expression or Range */
+#define INCSEQ(args, i, func) \
+    if (args->cell[i]->type != LVAL_QEXPR && args->cell[i]->type != LVAL_RANGE) { \
+        lval* err = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected Q-Expression.", func, i, ltype_name(args->cell[i]->type)); \
         lval_del(args); \
         return err; \
     }
 
 /* Macro for testing for being called with the empty list */
 #define EMPLST(args, func) \
-    if (args->cell[0]->count == 0) { \
+    if (args->cell[0]->type == LVAL_RANGE ? args->cell[0]->len == 0 : args->cell[0]->count == 0) { \
         lval* err = lval_err("Function '%s' passed empty list {}.", func); \
         lval_del(args); \
         return err; \
@@ -504,12 +640,19 @@ lval* builtin_max(lenv* e, lval* a){
 lval* builtin_head(lenv* e, lval* a){
     /* Check error conditions */
     INCARGS(a, 1, "head");
-    INCTYPE(a, 0, LVAL_QEXPR, "head");
+    INCSEQ(a, 0, "head");
     EMPLST(a, "head");
 
     /* Otherwise take first argument */
     lval* v = lval_take(a, 0);
 
+    /* The head of a Range is its first number */
+    if(v->type == LVAL_RANGE){
+        lval* x = lval_add(lval_qexpr(), lval_num(v->num));
+        lval_del(v);
+        return x;
+    }
+
     /* Delete all elements that are not head and return */
     while (v->count > 1){
         lval_del(lval_pop(v, 1));
@@ -522,11 +665,22 @@ lval* builtin_head(lenv* e, lval* a){
 lval* builtin_tail(lenv* e, lval* a){
     /* Check error conditions */
     INCARGS(a, 1, "tail");
-    INCTYPE(a, 0, LVAL_QEXPR, "tail");
+    INCSEQ(a, 0, "tail");
     EMPLST(a, "tail");
 
     /* Otherwise take all but first argument */
     lval* v = lval_take(a, 0);
+
+    /* The tail of a Range is the Range starting one step later, or nothing once its numbers would no longer fit in a long */
+    if(v->type == LVAL_RANGE){
+        if(!lval_range_at(v, 1, &v->num)){
+            v->len = 0;
+        } else if(v->len > 0){
+            v->len--;
+        }
+        return v;
+    }
+
     lval_del(lval_pop(v, 0));
 
     return v;
@@ -543,6 +697,7 @@ lval* lval_eval(lenv* e, lval* v);
 /* Takes a Q-Expression and evaluates it as if it were a S-Expression */
 lval* builtin_eval(lenv* e, lval* a){
     INCARGS(a, 1, "eval");
+    FORCE(a, 0, "eval");
     INCTYPE(a, 0, LVAL_QEXPR, "eval");
     
     lval* x = lval_take(a, 0);
@@ -551,14 +706,18 @@ lval* builtin_eval(lenv* e, lval* a){
     return lval_eval(e, x);
 }
 
+/* Moves every cell of 'y' onto the end of 'x' and deletes 'y' */
 lval* lval_join(lval* x, lval* y){
-    /* For each cell in 'y', add it to 'x' */
-    while(y->count){
-        x = lval_add(x, lval_pop(y, 0));
+    /* Reserve space for all of 'y' at once and copy the cell pointers across in one go */
+    if(y->count){
+        x->cell = realloc(x->cell, sizeof(lval*) * (x->count + y->count));
+        memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * y->count);
+        x->count += y->count;
     }
 
-    /* Delete the empty 'y' and return 'x' */
-    lval_del(y);
+    /* The cells now belong to 'x', so only free the pointer array and 'y' itself */
+    free(y->cell);
+    free(y);
 
     return x;
 }
@@ -567,16 +726,33 @@ lval* lval_join(lval* x, lval* y){
 lval* builtin_join(lenv* e, lval* a){
     /* Ensure each argument is a q-expression */
     for(int i=0; i < a->count; i++){
+        FORCE(a, i, "join");
         INCTYPE(a, i, LVAL_QEXPR, "join");
     }
 
-    lval* x = lval_pop(a, 0);
+    /* Count the elements of every argument so the result is only allocated once */
+    int total = 0;
+    for(int i=0; i < a->count; i++){
+        total += a->cell[i]->count;
+    }
+
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * total);
 
-    while(a->count){
-        x = lval_join(x, lval_pop(a, 0));
+    /* Move the cells of each argument across, then free the emptied argument */
+    for(int i=0; i < a->count; i++){
+        lval* y = a->cell[i];
+        if(y->count){
+            memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * y->count);
+            x->count += y->count;
+        }
+        free(y->cell);
+        free(y);
     }
 
-    lval_del(a);
+    /* The arguments have already been freed, so only free the pointer array and 'a' itself */
+    free(a->cell);
+    free(a);
 
     return x;
 }
@@ -586,27 +762,25 @@ lval* builtin_cons(lenv* e, lval* a){
     /* Ensure the first argument is a number or symbol and the second argument is a Q-expressions */
     INCARGS(a, 2, "cons");
     INCTYPE(a, 0, LVAL_NUM, "cons");
+    FORCE(a, 1, "cons");
     INCTYPE(a, 1, LVAL_QEXPR, "cons");
 
+    /* Turn the arguments into the single element list {x} and splice the Q-Expression onto it */
     lval* x = lval_pop(a, 1);
     a = builtin_list(e, a);
     return lval_join(a, x);
-    // Not sure whether this leads to a memory leak or not...
 }
 
 /* Returns the number of elements in a Q-Expression */
 lval* builtin_len(lenv* e, lval* a){
     /* Ensure the one and only argument is a Q-Expression */
     INCARGS(a, 1, "len");
-    INCTYPE(a, 0, LVAL_QEXPR, "len");
+    INCSEQ(a, 0, "len");
 
-    lval* n = lval_num(0);
-    a = lval_take(a, 0);
-    while(a->count){
-        lval* x = lval_pop(a, 0);
-        lval_del(x);
-        n->num++;
-    }
+    lval* v = a->cell[0];
+    LASSERT(a, v->type != LVAL_RANGE || v->len >= 0, "Function 'len' passed an infinite Range.");
+
+    lval* n = lval_num(v->type == LVAL_RANGE ? v->len : v->count);
     lval_del(a);
 
     return n;
@@ -616,233 +790,1858 @@ lval* builtin_len(lenv* e, lval* a){
 lval* builtin_init(lenv* e, lval* a){
     /* Check error conditions */
     INCARGS(a, 1, "init");
-    INCTYPE(a, 0, LVAL_QEXPR, "init");
+    INCSEQ(a, 0, "init");
     EMPLST(a, "head");
 
     /* Otherwise take all but last argument */
     lval* v = lval_take(a, 0);
+
+    /* An infinite Range has no last element, and a finite one just gets shorter */
+    if(v->type == LVAL_RANGE){
+        if(v->len > 0){
+            v->len--;
+        }
+        return v;
+    }
+
     lval_del(lval_pop(v, v->count-1));
 
     return v;
 }
 
-/* Assigns values to a list of variables (cannot be builtin variables) */
-lval* builtin_def(lenv* e, lval* a){
-    /* Check that first cell is a Q-Expression */
-    INCTYPE(a, 0, LVAL_QEXPR, "def");
+/* Returns the number of elements of a Q-Expression or Range (-1 if infinite) */
+long lval_seq_len(lval* v){
+    return v->type == LVAL_RANGE ? v->len : v->count;
+}
 
-    /* First argument is symbol list */
-    lval* syms = a->cell[0];
+/* Cuts the Q-Expression or Range 'v' down to the elements from 'start' up to but not including 'end', in place.
+   A Q-Expression keeps its own cell array and a Range just moves its bounds, so no elements are copied */
+lval* lval_slice(lval* v, long start, long end){
+    if(v->type == LVAL_RANGE){
+        /* An infinite Range cut past the numbers that fit in a long only has those that fit */
+        unsigned long fit = lval_range_fit(v);
+        if(!lval_range_at(v, start, &v->num)){
+            v->len = 0;
+            return v;
+        }
+        v->len = end < 0 ? -1 : end - start;
+        if(v->len >= 0 && (unsigned long) v->len > fit - start){
+            v->len = fit - start;
+        }
+        return v;
+    }
 
-    /* Ensure all elements of first list are symbols */
-    for(int i=0; i < syms->count; i++){
-        INCTYPE(syms, i, LVAL_SYM, "def");
+    for(long i=0; i<start; i++){
+        lval_del(v->cell[i]);
+    }
+    for(long i=end; i < v->count; i++){
+        lval_del(v->cell[i]);
     }
 
-    /* Check correct number of symbols and values */
-    LASSERT(a, syms->count == a->count-1, "Function 'def' cannot define incorrect number of values to symbols");
+    v->count = end - start;
+    memmove(&v->cell[0], &v->cell[start], sizeof(lval*) * v->count);
+    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
 
-    /* Assign copies of values to symbols, only if new symbol is not builtin */
-    for(int i=0; i < syms->count; i++){
-        for(int j=0; j < builtins_count; j++){
-            LASSERT(a, strcmp(syms->cell[i]->sym, builtins[j]), "Function 'def' cannot define builtin symbol");
-        }
-        lenv_put(e, syms->cell[i], a->cell[i+1]);
+    return v;
+}
+
+/* Shared implementation of take, drop and slice. Clamps the bounds to the length of the last argument and slices it */
+lval* builtin_cut(lenv* e, lval* a, int nargs, char* func){
+    INCARGS(a, nargs+1, func);
+    for(int i=0; i < nargs; i++){
+        INCTYPE(a, i, LVAL_NUM, func);
+        LASSERT(a, a->cell[i]->num >= 0, "Function '%s' passed a negative index.", func);
     }
+    INCSEQ(a, nargs, func);
 
-    lval_del(a);
-    
-    return lval_sexpr();
-}
+    long len = lval_seq_len(a->cell[nargs]);
+    long start = 0;
+    long end = len;
 
-/* Prints all of the named values in an environment if given 0, otherwise returns error */
-lval* builtin_values(lenv* e, lval* a){
-    /* Check error conditions */
-    INCARGS(a, 1, "values");
-    INCTYPE(a, 0, LVAL_SEXPR, "values");
-    LASSERT(a, a->cell[0]->count==0, "Function 'values' passed invalid input");
+    if(strcmp(func, "take")==0){ end = a->cell[0]->num; }
+    if(strcmp(func, "drop")==0){ start = a->cell[0]->num; }
+    if(strcmp(func, "slice")==0){ start = a->cell[0]->num; end = a->cell[1]->num; }
 
-    lenv_print(e);
-    lval_del(a);
+    /* Clamp to the list, where an infinite Range has no end */
+    if(len >= 0 && start > len){ start = len; }
+    if(len >= 0 && (end > len || end < 0)){ end = len; }
+    if(end >= 0 && end < start){ end = start; }
 
-    return lval_sexpr();
+    return lval_slice(lval_take(a, nargs), start, end);
 }
 
-/* Stops the prompt and exits */
-lval* builtin_exit(lenv* e, lval* a){
-    INCARGS(a, 1, "values");
-    INCTYPE(a, 0, LVAL_SEXPR, "values");
-    LASSERT(a, a->cell[0]->count==0, "Function 'values' passed invalid input");
-
-    while_var = 2;
-    lval_del(a);
+/* Takes a number n and a Q-Expression and returns its first n elements */
+lval* builtin_take(lenv* e, lval* a){
+    return builtin_cut(e, a, 1, "take");
+}
 
-    return lval_sexpr();
+/* Takes a number n and a Q-Expression and returns all but its first n elements */
+lval* builtin_drop(lenv* e, lval* a){
+    return builtin_cut(e, a, 1, "drop");
 }
 
-void lenv_add_builtin_to_array(char* name){
-    builtins = realloc(builtins, 1024); // Reallocating 64 bytes crashes the program, so need more
-    builtins[builtins_count] = name;
-    builtins_count++;
+/* Takes a start, an end and a Q-Expression and returns the elements from start up to but not including end */
+lval* builtin_slice(lenv* e, lval* a){
+    return builtin_cut(e, a, 2, "slice");
 }
 
-/* Adds new builtin to environment */
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func){
-    lenv_add_builtin_to_array(name);
-    
-    lval* k = lval_sym(name);
-    lval* v = lval_fun(func);
-    lenv_put(e, k, v);
-    lval_del(k);
-    lval_del(v);
+/* Takes an index and a Q-Expression and returns the element at that index */
+lval* builtin_nth(lenv* e, lval* a){
+    INCARGS(a, 2, "nth");
+    INCTYPE(a, 0, LVAL_NUM, "nth");
+    INCSEQ(a, 1, "nth");
+
+    long i = a->cell[0]->num;
+    lval* l = a->cell[1];
+    long len = lval_seq_len(l);
+    LASSERT(a, i >= 0 && (i < len || len < 0), "Function 'nth' passed index %li, out of range.", i);
+
+    if(l->type == LVAL_RANGE){
+        long n;
+        LASSERT(a, lval_range_at(l, i, &n), "Function 'nth' passed index %li, past the numbers that fit in the Range.", i);
+        lval_del(a);
+        return lval_num(n);
+    }
+
+    /* Swap the element out for the last one so it is not deleted along with the list */
+    lval* x = l->cell[i];
+    l->cell[i] = l->cell[l->count-1];
+    l->count--;
+    lval_del(a);
+
+    return x;
 }
 
-void lenv_add_builtins(lenv* e){
-    /* List functions */
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
-    lenv_add_builtin(e, "cons", builtin_cons);
-    lenv_add_builtin(e, "len", builtin_len);
-    lenv_add_builtin(e, "init", builtin_init);
+/* Takes a Q-Expression and returns its last element */
+lval* builtin_last(lenv* e, lval* a){
+    INCARGS(a, 1, "last");
+    INCSEQ(a, 0, "last");
+    EMPLST(a, "last");
 
-    /* Mathematical functions */
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "add", builtin_add);
-    lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "sub", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul);
-    lenv_add_builtin(e, "mul", builtin_mul);
-    lenv_add_builtin(e, "/", builtin_div);
-    lenv_add_builtin(e, "div", builtin_div);
-    lenv_add_builtin(e, "%", builtin_mod);
-    lenv_add_builtin(e, "mod", builtin_mod);
-    lenv_add_builtin(e, "^", builtin_pow);
-    lenv_add_builtin(e, "pow", builtin_pow);
-    lenv_add_builtin(e, "min", builtin_min);
-    lenv_add_builtin(e, "max", builtin_max);
+    lval* l = a->cell[0];
+    LASSERT(a, lval_seq_len(l) > 0, "Function 'last' passed an infinite Range.");
 
-    /* Variable functions */
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "values", builtin_values);
+    if(l->type == LVAL_RANGE){
+        long n = 0;
+        lval_range_at(l, l->len-1, &n);
+        lval_del(a);
+        return lval_num(n);
+    }
 
-    /* Misc. functions */
-    lenv_add_builtin(e, "exit", builtin_exit);
+    lval* x = l->cell[l->count-1];
+    l->count--;
+    lval_del(a);
+
+    return x;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v){
-    /* Evaluate children */
-    for(int i=0; i<v->count; i++){
-        v->cell[i] = lval_eval(e, v->cell[i]);
+/* Takes an end, a start and end, or a start, end and step, and returns the lazy Range of numbers from the start up to but not including the end */
+lval* builtin_range(lenv* e, lval* a){
+    LASSERT(a, a->count >= 1 && a->count <= 3, "Function 'range' passed incorrect number of arguments. Got %i, expected 1 to 3.", a->count);
+    for(int i=0; i < a->count; i++){
+        INCTYPE(a, i, LVAL_NUM, "range");
     }
 
-    /* Error checking */
-    for(int i=0; i<v->count; i++){
-        if(v->cell[i]->type==LVAL_ERR){
-            return lval_take(v, i);
-        }
+    long start = a->count > 1 ? a->cell[0]->num : 0;
+    long stop = a->count > 1 ? a->cell[1]->num : a->cell[0]->num;
+    long step = a->count > 2 ? a->cell[2]->num : 1;
+    LASSERT(a, step != 0, "Function 'range' passed a step of zero.");
+
+    /* Count the elements once so the Range never needs to be walked to find its length.
+       The distance between the bounds can be more than a long holds, so it is counted as an unsigned long */
+    unsigned long span = 0;
+    unsigned long stride = 1;
+    if(step > 0 && stop > start){
+        span = (unsigned long) stop - (unsigned long) start;
+        stride = step;
     }
-
-    /* Empty expression */
-    if(v->count==0){
-        return v;
+    if(step < 0 && stop < start){
+        span = (unsigned long) start - (unsigned long) stop;
+        stride = -(unsigned long) step;
     }
+    unsigned long len = span ? (span - 1) / stride + 1 : 0;
+    LASSERT(a, len <= LONG_MAX, "Function 'range' passed bounds %li and %li, which hold more numbers than a Range can count.", start, stop);
 
-    /* Single expression */
-    if(v->count==1){
-        return lval_take(v, 0);
-    }
+    lval_del(a);
+    return lval_range(start, step, (long) len);
+}
 
-    /* Ensure first element is a function after evaluation */
-    lval* f = lval_pop(v, 0);
-    if(f->type != LVAL_FUN){
-        lval_del(v);
-        lval_del(f);
-        return lval_err("First element is not a function!");
+/* Takes a start and optionally a step, and returns the infinite lazy Range counting up from the start */
+lval* builtin_from(lenv* e, lval* a){
+    LASSERT(a, a->count == 1 || a->count == 2, "Function 'from' passed incorrect number of arguments. Got %i, expected 1 or 2.", a->count);
+    for(int i=0; i < a->count; i++){
+        INCTYPE(a, i, LVAL_NUM, "from");
     }
+    LASSERT(a, a->count < 2 || a->cell[1]->num != 0, "Function 'from' passed a step of zero.");
 
-    /* If so, call function to get result */
-    lval* result = f->fun(e, v);
-    lval_del(f);
+    lval* v = lval_range(a->cell[0]->num, a->count > 1 ? a->cell[1]->num : 1, -1);
+    lval_del(a);
+    return v;
+}
 
-    return result;
+/* Higher-order list functions */
+
+/* Calls function 'f' on the single argument 'x' */
+lval* lval_call1(lenv* e, lval* f, lval* x){
+    return f->fun(e, lval_add(lval_sexpr(), x));
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-    /* Evaluate a symbol, returning an error if the symbol isn't in the environment */
-    if(v->type==LVAL_SYM){
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
-    }
-    
-    /* Evaluate S-expressions */
-    if (v->type == LVAL_SEXPR) { 
-        return lval_eval_sexpr(e, v); 
-    }
-    
-    /* All other lval types remain the same */
-    return v;
+/* Calls function 'f' on the two arguments 'x' and 'y' */
+lval* lval_call2(lenv* e, lval* f, lval* x, lval* y){
+    return f->fun(e, lval_add(lval_add(lval_sexpr(), x), y));
 }
 
-lval* lval_read_num(mpc_ast_t* t){
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE
-        ? lval_num(x)
-        : lval_err("invalid number");
+/* Returns whether 'f' is one of the arithmetic builtins, which can be computed without building argument lists */
+int lval_is_arith(lval* f){
+    return f->fun == builtin_add || f->fun == builtin_sub || f->fun == builtin_mul
+        || f->fun == builtin_div || f->fun == builtin_mod || f->fun == builtin_pow
+        || f->fun == builtin_min || f->fun == builtin_max;
 }
 
-lval* lval_read(mpc_ast_t* t){
-    /* If Number or Symbol, return conversion to that type */
-    if(strstr(t->tag, "number")){
-        return lval_read_num(t);
-    }
-    if(strstr(t->tag, "symbol")){
-        return lval_sym(t->contents);
+/* Returns whether 'f' is one of the arithmetic builtins that two numbers are folded with directly, which are the ones that cannot fail */
+int lval_is_fold_arith(lval* f){
+    return f->fun == builtin_add || f->fun == builtin_sub || f->fun == builtin_mul;
+}
+
+/* Applies 'f' to 'x' and returns the result, consuming 'x' */
+lval* lval_apply1(lenv* e, lval* f, lval* x){
+    /* An arithmetic builtin given a single number only negates it ('-') or returns it unchanged */
+    if(x->type == LVAL_NUM && lval_is_arith(f)){
+        if(f->fun == builtin_sub){
+            x->num = -x->num;
+        }
+        return x;
     }
 
-    /* If root (>) or sexpr then create empty list */
-    lval* x = NULL;
-    if(strcmp(t->tag, ">")==0){
-        x = lval_sexpr();
+    return lval_call1(e, f, x);
+}
+
+/* Tests 'x' with the predicate 'f', setting 'keep' if it returns a nonzero number. Returns an error or NULL, and does not consume 'x' */
+lval* lval_test(lenv* e, lval* f, lval* x, int* keep){
+    /* An arithmetic builtin given a single number returns it (or its negation), so it is true exactly when the number is */
+    if(x->type == LVAL_NUM && lval_is_arith(f)){
+        *keep = x->num != 0;
+        return NULL;
     }
-    if(strstr(t->tag, "sexpr")){
-        x = lval_sexpr();
+
+    lval* r = lval_call1(e, f, lval_copy(x));
+    if(r->type == LVAL_ERR){
+        return r;
     }
-    if(strstr(t->tag, "qexpr")){
-        x = lval_qexpr();
+    if(r->type != LVAL_NUM){
+        lval* err = lval_err("Predicate returned %s, expected Number.", ltype_name(r->type));
+        lval_del(r);
+        return err;
     }
 
-    /* Fill this list with any valid expression contained within */
-    for(int i=0; i < t->children_num; i++){
-        /* For loop skips these */
-        if(strcmp(t->children[i]->contents, "(")==0){
-            continue;
-        }
-        if(strcmp(t->children[i]->contents, ")")==0){
-            continue;
-        }
-        if(strcmp(t->children[i]->contents, "{")==0){
-            continue;
-        }
-        if(strcmp(t->children[i]->contents, "}")==0){
-            continue;
-        }
-        if(strcmp(t->children[i]->tag, "regex")==0){
-            continue;
-        }
+    *keep = r->num != 0;
+    lval_del(r);
+    return NULL;
+}
 
-        x = lval_add(x, lval_read(t->children[i]));
+/* Folds 'x' into 'acc' as f(acc, x), or as f(x, acc) if 'right' is set. Consumes 'acc' but not 'x' */
+lval* lval_fold_step(lenv* e, lval* f, lval* acc, lval* x, int right){
+    /* Fold numbers directly for the arithmetic builtins that cannot fail */
+    if(acc->type == LVAL_NUM && x->type == LVAL_NUM && lval_is_fold_arith(f)){
+        if(f->fun == builtin_add){ acc->num += x->num; }
+        if(f->fun == builtin_mul){ acc->num *= x->num; }
+        if(f->fun == builtin_sub){ acc->num = right ? x->num - acc->num : acc->num - x->num; }
+        return acc;
     }
 
-    return x;
+    return right
+        ? lval_call2(e, f, lval_copy(x), acc)
+        : lval_call2(e, f, acc, lval_copy(x));
 }
 
-int main(int argc, char** argv) {
-  
+/* Takes a function and a Q-Expression and returns a Q-Expression of the function applied to each element */
+lval* builtin_map(lenv* e, lval* a){
+    INCARGS(a, 2, "map");
+    INCTYPE(a, 0, LVAL_FUN, "map");
+    FORCE(a, 1, "map");
+    INCTYPE(a, 1, LVAL_QEXPR, "map");
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+
+    /* The result has the same length as the input, so write each result back into the input's cell array */
+    for(int i=0; i < l->count; i++){
+        l->cell[i] = lval_apply1(e, f, l->cell[i]);
+        if(l->cell[i]->type == LVAL_ERR){
+            lval* err = lval_pop(l, i);
+            lval_del(a);
+            return err;
+        }
+    }
+
+    return lval_take(a, 1);
+}
+
+/* Takes a function and a Q-Expression and returns a Q-Expression of the elements for which the function returns a nonzero number */
+lval* builtin_filter(lenv* e, lval* a){
+    INCARGS(a, 2, "filter");
+    INCTYPE(a, 0, LVAL_FUN, "filter");
+    FORCE(a, 1, "filter");
+    INCTYPE(a, 1, LVAL_QEXPR, "filter");
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+
+    /* Kept elements are compacted towards the front of the input's cell array */
+    int kept = 0;
+    for(int i=0; i < l->count; i++){
+        lval* x = l->cell[i];
+        int keep = 0;
+
+        lval* err = lval_test(e, f, x, &keep);
+        if(err){
+            /* The kept elements and everything from 'i' on are still owned by the list, so close the gap before deleting it */
+            memmove(&l->cell[kept], &l->cell[i], sizeof(lval*) * (l->count - i));
+            l->count -= i - kept;
+            lval_del(a);
+            return err;
+        }
+
+        if(keep){
+            l->cell[kept++] = x;
+        } else{
+            lval_del(x);
+        }
+    }
+
+    /* Shrink the cell array once to the number of kept elements */
+    l->count = kept;
+    l->cell = realloc(l->cell, sizeof(lval*) * kept);
+
+    return lval_take(a, 1);
+}
+
+/* Shared implementation of foldl and foldr. Folds from the left with f(acc, x) or from the right with f(x, acc) */
+lval* builtin_fold(lenv* e, lval* a, int right, char* func){
+    INCARGS(a, 3, func);
+    INCTYPE(a, 0, LVAL_FUN, func);
+    INCSEQ(a, 2, func);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[2];
+    LASSERT(a, l->type != LVAL_RANGE || l->len >= 0, "Function '%s' passed an infinite Range.", func);
+
+    /* Take the initial value out of the arguments so it can be used as the accumulator */
+    lval* acc = a->cell[1];
+    a->cell[1] = lval_sexpr();
+
+    /* Numbers of a Range are generated into 'x' one at a time rather than materialized */
+    lval x;
+    x.type = LVAL_NUM;
+
+    long count = l->type == LVAL_RANGE ? l->len : l->count;
+    for(long n=0; n < count; n++){
+        long i = right ? count - 1 - n : n;
+        if(l->type == LVAL_RANGE){
+            lval_range_at(l, i, &x.num);
+            acc = lval_fold_step(e, f, acc, &x, right);
+        } else{
+            acc = lval_fold_step(e, f, acc, l->cell[i], right);
+        }
+        if(acc->type == LVAL_ERR){
+            break;
+        }
+    }
+
+    lval_del(a);
+    return acc;
+}
+
+/* Takes a function, an initial value and a Q-Expression and folds the function over the elements from the left */
+lval* builtin_foldl(lenv* e, lval* a){
+    return builtin_fold(e, a, 0, "foldl");
+}
+
+/* Takes a function, an initial value and a Q-Expression and folds the function over the elements from the right */
+lval* builtin_foldr(lenv* e, lval* a){
+    return builtin_fold(e, a, 1, "foldr");
+}
+
+/* Pipelines */
+
+/* Kinds of pipeline stage */
+enum { LSTAGE_MAP, LSTAGE_FILTER, LSTAGE_TAKE, LSTAGE_FOLDL };
+
+/* A single compiled pipeline stage, such as {map f} or {foldl f z} */
+typedef struct {
+    int kind;
+    lval* f;
+    long n;
+    lval* acc;
+} lstage;
+
+/* Deletes the evaluated arguments held by the first 'n' stages and the stage array itself */
+void lstages_del(lstage* st, int n){
+    for(int i=0; i<n; i++){
+        if(st[i].f){ lval_del(st[i].f); }
+        if(st[i].acc){ lval_del(st[i].acc); }
+    }
+    free(st);
+}
+
+/* Compiles the stage Q-Expressions a->cell[1..] into 'st'. Returns an error or NULL */
+lval* lstages_compile(lenv* e, lval* a, lstage* st, char* func){
+    int n = a->count - 1;
+
+    for(int i=0; i<n; i++){
+        lval* q = a->cell[i+1];
+        st[i].f = NULL;
+        st[i].acc = NULL;
+
+        if(q->type != LVAL_QEXPR || q->count == 0 || q->cell[0]->type != LVAL_SYM){
+            lstages_del(st, i);
+            return lval_err("Function '%s' passed invalid stage %i, expected {map f}, {filter f}, {take n} or {foldl f z}.", func, i+1);
+        }
+
+        char* name = q->cell[0]->sym;
+        int arity;
+        if(strcmp(name, "map")==0){ st[i].kind = LSTAGE_MAP; arity = 2; }
+        else if(strcmp(name, "filter")==0){ st[i].kind = LSTAGE_FILTER; arity = 2; }
+        else if(strcmp(name, "take")==0){ st[i].kind = LSTAGE_TAKE; arity = 2; }
+        else if(strcmp(name, "foldl")==0){ st[i].kind = LSTAGE_FOLDL; arity = 3; }
+        else{
+            lstages_del(st, i);
+            return lval_err("Function '%s' passed unknown stage '%s'.", func, name);
+        }
+
+        if(q->count != arity){
+            lstages_del(st, i);
+            return lval_err("Stage '%s' passed incorrect number of arguments. Got %i, expected %i.", name, q->count-1, arity-1);
+        }
+        if(st[i].kind == LSTAGE_FOLDL && i != n-1){
+            lstages_del(st, i);
+            return lval_err("Stage 'foldl' must be the last stage of a pipeline.");
+        }
+
+        /* Evaluate the stage's arguments */
+        lval* x = lval_eval(e, lval_copy(q->cell[1]));
+        if(st[i].kind == LSTAGE_TAKE){
+            if(x->type == LVAL_ERR){
+                lstages_del(st, i);
+                return x;
+            }
+            st[i].n = x->type == LVAL_NUM ? x->num : -1;
+            lval_del(x);
+            if(st[i].n < 0){
+                lstages_del(st, i);
+                return lval_err("Stage 'take' passed invalid count, expected a nonnegative Number.");
+            }
+        } else{
+            if(x->type != LVAL_FUN){
+                lval* err = x;
+                if(x->type != LVAL_ERR){
+                    err = lval_err("Stage '%s' passed %s, expected Function.", name, ltype_name(x->type));
+                    lval_del(x);
+                }
+                lstages_del(st, i);
+                return err;
+            }
+            st[i].f = x;
+        }
+        if(st[i].kind == LSTAGE_FOLDL){
+            st[i].acc = lval_eval(e, lval_copy(q->cell[2]));
+            if(st[i].acc->type == LVAL_ERR){
+                lval* err = st[i].acc;
+                st[i].acc = NULL;
+                lstages_del(st, i+1);
+                return err;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the most elements the 'n' stages 'st' can let through from the source 'l', or -1 if that has no end */
+long lstages_count(lval* l, lstage* st, int n){
+    /* The output can never be longer than the source or than any take stage allows */
+    long count = l->type == LVAL_RANGE ? l->len : l->count;
+    for(int s=0; s<n; s++){
+        if(st[s].kind == LSTAGE_TAKE && (count < 0 || st[s].n < count)){
+            count = st[s].n;
+        }
+    }
+    return count;
+}
+
+/* Takes a Q-Expression or Range followed by stages such as {map f}, {filter f}, {take n} and {foldl f z}, and runs every element through all stages in a single pass */
+lval* builtin_pipe(lenv* e, lval* a){
+    LASSERT(a, a->count >= 1, "Function 'pipe' passed no arguments.");
+    INCSEQ(a, 0, "pipe");
+
+    int n = a->count - 1;
+    lstage* st = malloc(sizeof(lstage) * (n ? n : 1));
+    lval* err = lstages_compile(e, a, st, "pipe");
+    if(err){
+        lval_del(a);
+        return err;
+    }
+
+    lval* l = a->cell[0];
+    int range = l->type == LVAL_RANGE;
+    int folding = n > 0 && st[n-1].kind == LSTAGE_FOLDL;
+    int done = 0;
+
+    long count = lstages_count(l, st, n);
+    if(count < 0){
+        lstages_del(st, n);
+        lval_del(a);
+        return lval_err("Function 'pipe' passed an infinite Range without a take stage.");
+    }
+
+    /* Surviving elements of a Q-Expression are compacted towards the front of its own cell array, so no intermediate lists are built.
+       A Range has no cells, so its survivors go into an array sized once up front */
+    lval** out = range ? malloc(sizeof(lval*) * (folding || count == 0 ? 1 : count)) : l->cell;
+    int kept = 0;
+    long i = 0;
+    long num = 0;
+    for(; (range ? (l->len < 0 || i < l->len) && lval_range_at(l, i, &num) : i < l->count) && !done; i++){
+        lval* x = range ? lval_num(num) : l->cell[i];
+        int keep = 1;
+
+        for(int s=0; s<n && keep; s++){
+            switch(st[s].kind){
+                case LSTAGE_MAP:
+                    x = lval_apply1(e, st[s].f, x);
+                    if(x->type == LVAL_ERR){ err = x; x = NULL; keep = 0; }
+                    break;
+                case LSTAGE_FILTER:
+                    err = lval_test(e, st[s].f, x, &keep);
+                    if(err){ keep = 0; }
+                    break;
+                case LSTAGE_TAKE:
+                    /* Stop the whole pipeline once a take stage has let through its last element */
+                    if(st[s].n == 0){ keep = 0; done = 1; break; }
+                    st[s].n--;
+                    if(st[s].n == 0){ done = 1; }
+                    break;
+                case LSTAGE_FOLDL:
+                    st[s].acc = lval_fold_step(e, st[s].f, st[s].acc, x, 0);
+                    if(st[s].acc->type == LVAL_ERR){ err = st[s].acc; st[s].acc = NULL; }
+                    keep = 0;
+                    break;
+            }
+        }
+
+        if(keep){
+            out[kept++] = x;
+        } else if(x){
+            lval_del(x);
+        }
+        if(err){
+            i++;
+            break;
+        }
+    }
+
+    /* Delete any elements the pipeline stopped before reaching */
+    if(!range){
+        for(; i < l->count; i++){
+            lval_del(l->cell[i]);
+        }
+        l->count = kept;
+    }
+
+    lval* result;
+    if(err || folding){
+        for(int k=0; k < kept && range; k++){
+            lval_del(out[k]);
+        }
+        result = err ? err : st[n-1].acc;
+        if(!err){
+            st[n-1].acc = NULL;
+        }
+    } else if(range){
+        result = lval_qexpr();
+        result->count = kept;
+        result->cell = out;
+        out = NULL;
+    } else{
+        result = lval_pop(a, 0);
+        result->cell = realloc(result->cell, sizeof(lval*) * kept);
+    }
+
+    if(range){
+        free(out);
+    }
+    lstages_del(st, n);
+    lval_del(a);
+    return result;
+}
+
+/* Takes the same arguments as 'pipe' and prints the fused plan instead of running it */
+lval* builtin_explain(lenv* e, lval* a){
+    LASSERT(a, a->count >= 1, "Function 'explain' passed no arguments.");
+    INCSEQ(a, 0, "explain");
+
+    int n = a->count - 1;
+    lstage* st = malloc(sizeof(lstage) * (n ? n : 1));
+    lval* err = lstages_compile(e, a, st, "explain");
+    if(err){
+        lval_del(a);
+        return err;
+    }
+
+    /* Refuse the same pipelines 'pipe' does */
+    lval* l = a->cell[0];
+    if(lstages_count(l, st, n) < 0){
+        lstages_del(st, n);
+        lval_del(a);
+        return lval_err("Function 'explain' passed an infinite Range without a take stage.");
+    }
+
+    if(l->type == LVAL_RANGE){
+        printf("source: lazy Range from %li by %li, ", l->num, l->step);
+        l->len < 0 ? printf("infinite\n") : printf("%li elements\n", l->len);
+    } else{
+        printf("source: Q-Expression of %i elements\n", l->count);
+    }
+    for(int s=0; s<n; s++){
+        printf("  -> ");
+        lval_print(a->cell[s+1]);
+        if(st[s].f && (st[s].kind == LSTAGE_FOLDL ? lval_is_fold_arith(st[s].f) : lval_is_arith(st[s].f))){
+            printf(" [arithmetic, computed directly]");
+        }
+        if(st[s].kind == LSTAGE_TAKE){
+            printf(" [stops the pipeline after %li elements]", st[s].n);
+        }
+        putchar('\n');
+    }
+    if(n > 0 && st[n-1].kind == LSTAGE_FOLDL){
+        puts("result: value of the fold");
+    } else{
+        puts(l->type == LVAL_RANGE ? "result: Q-Expression, allocated once" : "result: Q-Expression, compacted in place in the source");
+    }
+    printf("fused into 1 pass, 0 intermediate lists\n");
+
+    lstages_del(st, n);
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* Sorting */
+
+/* Compares two lvals in a total order: first by type, then by number, by string, or element by element for lists */
+int lval_cmp(lval* x, lval* y){
+    if(x->type != y->type){
+        return x->type < y->type ? -1 : 1;
+    }
+
+    switch(x->type){
+        case LVAL_NUM:
+            return (x->num > y->num) - (x->num < y->num);
+        case LVAL_ERR:
+            return strcmp(x->err, y->err);
+        case LVAL_SYM:
+            return strcmp(x->sym, y->sym);
+        case LVAL_FUN:
+            return memcmp(&x->fun, &y->fun, sizeof(lbuiltin));
+        case LVAL_RANGE:
+            /* Ranges are ordered by start, then step, then length (with infinite ranges last) */
+            if(x->num != y->num){
+                return x->num < y->num ? -1 : 1;
+            }
+            if(x->step != y->step){
+                return x->step < y->step ? -1 : 1;
+            }
+            return ((unsigned long) x->len > (unsigned long) y->len) - ((unsigned long) x->len < (unsigned long) y->len);
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i=0; i < x->count && i < y->count; i++){
+                int c = lval_cmp(x->cell[i], y->cell[i]);
+                if(c != 0){
+                    return c;
+                }
+            }
+            return (x->count > y->count) - (x->count < y->count);
+    }
+
+    return 0;
+}
+
+/* Below this many elements, sorting falls back to insertion sort (and numbers skip the radix sort) */
+#define SORT_SMALL 32
+
+void lval_swap(lval** v, int i, int j){
+    lval* t = v[i];
+    v[i] = v[j];
+    v[j] = t;
+}
+
+void lval_insertion_sort(lval** v, int n){
+    for(int i=1; i<n; i++){
+        lval* x = v[i];
+        int j = i;
+        while(j > 0 && lval_cmp(v[j-1], x) > 0){
+            v[j] = v[j-1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+/* Restores the max-heap property for the subtree rooted at 'i' of the heap 'v' of size 'n' */
+void lval_sift_down(lval** v, int i, int n){
+    while(2*i + 1 < n){
+        int c = 2*i + 1;
+        if(c + 1 < n && lval_cmp(v[c], v[c+1]) < 0){
+            c++;
+        }
+        if(lval_cmp(v[i], v[c]) >= 0){
+            return;
+        }
+        lval_swap(v, i, c);
+        i = c;
+    }
+}
+
+void lval_heap_sort(lval** v, int n){
+    for(int i=n/2 - 1; i >= 0; i--){
+        lval_sift_down(v, i, n);
+    }
+    for(int i=n-1; i > 0; i--){
+        lval_swap(v, 0, i);
+        lval_sift_down(v, 0, i);
+    }
+}
+
+/* Quicksort with a median-of-three pivot, switching to heapsort once 'depth' runs out so the worst case stays O(n log n) */
+void lval_intro_sort(lval** v, int n, int depth){
+    while(n > SORT_SMALL){
+        if(depth == 0){
+            lval_heap_sort(v, n);
+            return;
+        }
+        depth--;
+
+        /* Move the median of the first, middle and last elements to the front as the pivot */
+        int m = n / 2;
+        if(lval_cmp(v[m], v[0]) < 0){ lval_swap(v, m, 0); }
+        if(lval_cmp(v[n-1], v[0]) < 0){ lval_swap(v, n-1, 0); }
+        if(lval_cmp(v[n-1], v[m]) < 0){ lval_swap(v, n-1, m); }
+        lval_swap(v, 0, m);
+
+        /* Hoare partition around v[0] */
+        lval* p = v[0];
+        int i = 0;
+        int j = n;
+        while(1){
+            do { i++; } while(i < n && lval_cmp(v[i], p) < 0);
+            do { j--; } while(lval_cmp(v[j], p) > 0);
+            if(i >= j){
+                break;
+            }
+            lval_swap(v, i, j);
+        }
+        lval_swap(v, 0, j);
+
+        /* Recurse into the smaller side and loop on the larger one */
+        if(j < n - j - 1){
+            lval_intro_sort(v, j, depth);
+            v += j + 1;
+            n -= j + 1;
+        } else{
+            lval_intro_sort(v + j + 1, n - j - 1, depth);
+            n = j;
+        }
+    }
+
+    lval_insertion_sort(v, n);
+}
+
+/* Sorts the numbers of 'v' with an LSD radix sort, one byte per pass */
+void lval_radix_sort(lval** v, int n){
+    unsigned long* keys = malloc(sizeof(unsigned long) * n);
+    unsigned long* tmp = malloc(sizeof(unsigned long) * n);
+
+    /* Flipping the sign bit makes unsigned order agree with signed order */
+    unsigned long sign = 1UL << (sizeof(long)*8 - 1);
+    for(int i=0; i<n; i++){
+        keys[i] = (unsigned long) v[i]->num ^ sign;
+    }
+
+    for(int shift=0; shift < (int) sizeof(long)*8; shift += 8){
+        int counts[256] = {0};
+        for(int i=0; i<n; i++){
+            counts[(keys[i] >> shift) & 0xff]++;
+        }
+
+        /* Skip passes where every key has the same byte */
+        if(counts[(keys[0] >> shift) & 0xff] == n){
+            continue;
+        }
+
+        int total = 0;
+        for(int b=0; b<256; b++){
+            int c = counts[b];
+            counts[b] = total;
+            total += c;
+        }
+        for(int i=0; i<n; i++){
+            tmp[counts[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+
+        unsigned long* t = keys;
+        keys = tmp;
+        tmp = t;
+    }
+
+    /* All elements are numbers, so the sorted values can simply be written back in order */
+    for(int i=0; i<n; i++){
+        v[i]->num = (long) (keys[i] ^ sign);
+    }
+
+    free(keys);
+    free(tmp);
+}
+
+/* Sorts the 'n' elements of 'v', with radix sort if 'numbers' says they are all numbers and introsort otherwise */
+void lval_sort_run(lval** v, int n, int numbers){
+    if(numbers && n > SORT_SMALL){
+        lval_radix_sort(v, n);
+    } else{
+        int depth = 0;
+        for(int i=n; i > 1; i >>= 1){
+            depth += 2;
+        }
+        lval_intro_sort(v, n, depth);
+    }
+}
+
+/* Parallel sorting */
+
+/* Lists shorter than this are sorted on one thread, since starting the threads would cost more than it saves */
+#define SORT_PARALLEL (1 << 16)
+
+/* One thread's share of a parallel sort: either a slice to sort, or two adjacent sorted runs to merge */
+typedef struct {
+    lval** v;
+    int n;
+    int numbers;
+
+    /* When merging, the first run is 'v[0]' to 'v[mid-1]', the second the rest, and the result goes to 'out' */
+    int mid;
+    lval** out;
+} lsort_part;
+
+void* lsort_sort_worker(void* arg){
+    lsort_part* p = arg;
+    lval_sort_run(p->v, p->n, p->numbers);
+    return NULL;
+}
+
+/* Merges the two sorted runs into 'out' */
+void* lsort_merge_worker(void* arg){
+    lsort_part* p = arg;
+    int i = 0;
+    int j = p->mid;
+    int k = 0;
+    while(i < p->mid && j < p->n){
+        p->out[k++] = lval_cmp(p->v[j], p->v[i]) < 0 ? p->v[j++] : p->v[i++];
+    }
+    while(i < p->mid){
+        p->out[k++] = p->v[i++];
+    }
+    while(j < p->n){
+        p->out[k++] = p->v[j++];
+    }
+    return NULL;
+}
+
+#ifndef _WIN32
+
+/* Runs 'work' on each of the 'n' parts, the first on the calling thread and the rest on threads of their own.
+   A part whose thread can't be started is run on the calling thread instead */
+void lsort_run_parts(void* (*work)(void*), lsort_part* parts, int n){
+    pthread_t* threads = malloc(sizeof(pthread_t) * n);
+    int* started = malloc(sizeof(int) * n);
+    for(int i=1; i<n; i++){
+        started[i] = pthread_create(&threads[i], NULL, work, &parts[i]) == 0;
+        if(!started[i]){
+            work(&parts[i]);
+        }
+    }
+    work(&parts[0]);
+    for(int i=1; i<n; i++){
+        if(started[i]){
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+/* Sorts 'v' by cutting it into one slice per job, sorting the slices at once, then merging neighbouring runs
+   in rounds, each round's merges also running at once, until a single run is left */
+void lval_sort_parallel(lval** v, int n, int numbers){
+    int slices = parse_jobs;
+    lsort_part* parts = malloc(sizeof(lsort_part) * slices);
+
+    /* 'bounds[i]' is where run 'i' starts, with 'bounds[runs]' == 'n' */
+    int* bounds = malloc(sizeof(int) * (slices + 1));
+    for(int i=0; i <= slices; i++){
+        bounds[i] = (int) ((long) n * i / slices);
+    }
+    for(int i=0; i < slices; i++){
+        parts[i].v = v + bounds[i];
+        parts[i].n = bounds[i+1] - bounds[i];
+        parts[i].numbers = numbers;
+    }
+    lsort_run_parts(lsort_sort_worker, parts, slices);
+
+    /* Merges go back and forth between 'v' and 'tmp' */
+    lval** tmp = malloc(sizeof(lval*) * n);
+    lval** from = v;
+    lval** to = tmp;
+    int runs = slices;
+    while(runs > 1){
+        int merges = runs / 2;
+        for(int i=0; i < merges; i++){
+            parts[i].v = from + bounds[2*i];
+            parts[i].n = bounds[2*i + 2] - bounds[2*i];
+            parts[i].mid = bounds[2*i + 1] - bounds[2*i];
+            parts[i].out = to + bounds[2*i];
+        }
+        lsort_run_parts(lsort_merge_worker, parts, merges);
+
+        /* An odd run out is carried over to the next round as it is */
+        if(runs % 2){
+            memcpy(to + bounds[runs-1], from + bounds[runs-1], sizeof(lval*) * (n - bounds[runs-1]));
+        }
+
+        for(int i=0; i <= merges; i++){
+            bounds[i] = bounds[2*i];
+        }
+        if(runs % 2){
+            bounds[merges + 1] = n;
+        }
+        runs = merges + runs % 2;
+
+        lval** t = from;
+        from = to;
+        to = t;
+    }
+
+    if(from != v){
+        memcpy(v, from, sizeof(lval*) * n);
+    }
+
+    free(tmp);
+    free(bounds);
+    free(parts);
+}
+
+#endif
+
+/* Takes a Q-Expression and returns it sorted in ascending order */
+lval* builtin_sort(lenv* e, lval* a){
+    INCARGS(a, 1, "sort");
+    FORCE(a, 0, "sort");
+    INCTYPE(a, 0, LVAL_QEXPR, "sort");
+
+    lval* l = lval_take(a, 0);
+
+    int numbers = 1;
+    for(int i=0; i < l->count && numbers; i++){
+        numbers = l->cell[i]->type == LVAL_NUM;
+    }
+
+#ifndef _WIN32
+    if(parse_jobs > 1 && l->count >= SORT_PARALLEL){
+        lval_sort_parallel(l->cell, l->count, numbers);
+        return l;
+    }
+#endif
+
+    lval_sort_run(l->cell, l->count, numbers);
+    return l;
+}
+
+/* Assigns values to a list of variables (cannot be builtin variables) */
+lval* builtin_def(lenv* e, lval* a){
+    /* Check that first cell is a Q-Expression */
+    INCTYPE(a, 0, LVAL_QEXPR, "def");
+
+    /* First argument is symbol list */
+    lval* syms = a->cell[0];
+
+    /* Ensure all elements of first list are symbols */
+    for(int i=0; i < syms->count; i++){
+        INCTYPE(syms, i, LVAL_SYM, "def");
+    }
+
+    /* Check correct number of symbols and values */
+    LASSERT(a, syms->count == a->count-1, "Function 'def' cannot define incorrect number of values to symbols");
+
+    /* Assign copies of values to symbols, only if new symbol is not builtin */
+    for(int i=0; i < syms->count; i++){
+        for(int j=0; j < builtins_count; j++){
+            LASSERT(a, strcmp(syms->cell[i]->sym, builtins[j]), "Function 'def' cannot define builtin symbol");
+        }
+        lenv_put(e, syms->cell[i], a->cell[i+1]);
+    }
+
+    lval_del(a);
+    
+    return lval_sexpr();
+}
+
+/* Prints all of the named values in an environment if given 0, otherwise returns error */
+lval* builtin_values(lenv* e, lval* a){
+    /* Check error conditions */
+    INCARGS(a, 1, "values");
+    INCTYPE(a, 0, LVAL_SEXPR, "values");
+    LASSERT(a, a->cell[0]->count==0, "Function 'values' passed invalid input");
+
+    lenv_print(e);
+    lval_del(a);
+
+    return lval_sexpr();
+}
+
+/* Stops the prompt and exits */
+lval* builtin_exit(lenv* e, lval* a){
+    INCARGS(a, 1, "values");
+    INCTYPE(a, 0, LVAL_SEXPR, "values");
+    LASSERT(a, a->cell[0]->count==0, "Function 'values' passed invalid input");
+
+    while_var = 2;
+    lval_del(a);
+
+    return lval_sexpr();
+}
+
+void lenv_add_builtin_to_array(char* name){
+    builtins = realloc(builtins, 1024); // Reallocating 64 bytes crashes the program, so need more
+    builtins[builtins_count] = name;
+    builtins_count++;
+}
+
+/* Adds new builtin to environment */
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func){
+    lenv_add_builtin_to_array(name);
+    
+    lval* k = lval_sym(name);
+    lval* v = lval_fun(func);
+    lenv_put(e, k, v);
+    lval_del(k);
+    lval_del(v);
+}
+
+lval* builtin_load(lenv* e, lval* a);
+
+void lenv_add_builtins(lenv* e){
+    /* List functions */
+    lenv_add_builtin(e, "head", builtin_head);
+    lenv_add_builtin(e, "tail", builtin_tail);
+    lenv_add_builtin(e, "list", builtin_list);
+    lenv_add_builtin(e, "eval", builtin_eval);
+    lenv_add_builtin(e, "join", builtin_join);
+    lenv_add_builtin(e, "cons", builtin_cons);
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "init", builtin_init);
+    lenv_add_builtin(e, "sort", builtin_sort);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "slice", builtin_slice);
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "from", builtin_from);
+
+    /* Higher-order list functions */
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "pipe", builtin_pipe);
+    lenv_add_builtin(e, "explain", builtin_explain);
+
+    /* Mathematical functions */
+    lenv_add_builtin(e, "+", builtin_add);
+    lenv_add_builtin(e, "add", builtin_add);
+    lenv_add_builtin(e, "-", builtin_sub);
+    lenv_add_builtin(e, "sub", builtin_sub);
+    lenv_add_builtin(e, "*", builtin_mul);
+    lenv_add_builtin(e, "mul", builtin_mul);
+    lenv_add_builtin(e, "/", builtin_div);
+    lenv_add_builtin(e, "div", builtin_div);
+    lenv_add_builtin(e, "%", builtin_mod);
+    lenv_add_builtin(e, "mod", builtin_mod);
+    lenv_add_builtin(e, "^", builtin_pow);
+    lenv_add_builtin(e, "pow", builtin_pow);
+    lenv_add_builtin(e, "min", builtin_min);
+    lenv_add_builtin(e, "max", builtin_max);
+
+    /* Variable functions */
+    lenv_add_builtin(e, "def", builtin_def);
+    lenv_add_builtin(e, "values", builtin_values);
+
+    /* Misc. functions */
+    lenv_add_builtin(e, "exit", builtin_exit);
+    lenv_add_builtin(e, "load", builtin_load);
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v){
+    /* Evaluate children */
+    for(int i=0; i<v->count; i++){
+        v->cell[i] = lval_eval(e, v->cell[i]);
+    }
+
+    /* Error checking */
+    for(int i=0; i<v->count; i++){
+        if(v->cell[i]->type==LVAL_ERR){
+            return lval_take(v, i);
+        }
+    }
+
+    /* Empty expression */
+    if(v->count==0){
+        return v;
+    }
+
+    /* Single expression */
+    if(v->count==1){
+        return lval_take(v, 0);
+    }
+
+    /* Ensure first element is a function after evaluation */
+    lval* f = lval_pop(v, 0);
+    if(f->type != LVAL_FUN){
+        lval_del(v);
+        lval_del(f);
+        return lval_err("First element is not a function!");
+    }
+
+    /* If so, call function to get result */
+    lval* result = f->fun(e, v);
+    lval_del(f);
+
+    return result;
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+    /* Evaluate a symbol, returning an error if the symbol isn't in the environment */
+    if(v->type==LVAL_SYM){
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+    
+    /* Evaluate S-expressions */
+    if (v->type == LVAL_SEXPR) { 
+        return lval_eval_sexpr(e, v); 
+    }
+    
+    /* All other lval types remain the same */
+    return v;
+}
+
+lval* lval_read_num(mpc_ast_t* t){
+    errno = 0;
+    long x = strtol(t->contents, NULL, 10);
+    return errno != ERANGE
+        ? lval_num(x)
+        : lval_err("invalid number");
+}
+
+lval* lval_read(mpc_ast_t* t){
+    /* If Number or Symbol, return conversion to that type */
+    if(mpc_ast_has_tag(t, tag_number)){
+        return lval_read_num(t);
+    }
+    if(mpc_ast_has_tag(t, tag_symbol)){
+        return lval_sym(t->contents);
+    }
+
+    /* If root (>) or sexpr then create empty list */
+    lval* x = NULL;
+    if(t->tags == MPC_TAG_BIT(MPC_TAG_ROOT)){
+        x = lval_sexpr();
+    }
+    if(mpc_ast_has_tag(t, tag_sexpr)){
+        x = lval_sexpr();
+    }
+    if(mpc_ast_has_tag(t, tag_qexpr)){
+        x = lval_qexpr();
+    }
+
+    /* Fill this list with any valid expression contained within, skipping the brackets and the start and end of input */
+    for(int i=0; i < t->children_num; i++){
+        if(!(t->children[i]->tags & tags_expr)){
+            continue;
+        }
+
+        x = lval_add(x, lval_read(t->children[i]));
+    }
+
+    return x;
+}
+
+/* Direct reader */
+
+/* The direct reader turns source text straight into lvals in a single pass, without building an mpc AST.
+   It accepts exactly the 'lispy' grammar, and on a syntax error reports the same position and expected
+   list as mpc: it records each failed alternative in the order mpc tries them and keeps the furthest ones */
+
+/* Expected strings, spelled as mpc spells them for the grammar */
+#define LREAD_DIGIT   "one of '0123456789'"
+#define LREAD_DIGITS  "one or more of one of '0123456789'"
+#define LREAD_SYMBOL  "one of 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/^%\\=<>!&'"
+#define LREAD_SYMBOLS "one or more of one of 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/^%\\=<>!&'"
+
+/* At most this many distinct expected strings can be recorded at one position */
+#define LREAD_EXPECTED_MAX 16
+
+typedef struct {
+    const char* filename;
+    const char* s;
+    long n;
+    long pos;
+
+    /* Length of all of 's', which is more than 'n' when only part of it is being read */
+    long size;
+
+    /* Set once a syntax error has been found */
+    int failed;
+
+    /* Furthest failure position and what was expected there */
+    long fail;
+    int expected_num;
+    const char* expected[LREAD_EXPECTED_MAX];
+} lreader;
+
+/* Records that 'what' was expected at 'pos', keeping only the furthest failures */
+void lread_expect(lreader* r, long pos, const char* what){
+    if(pos > r->fail){
+        r->fail = pos;
+        r->expected_num = 0;
+    }
+    if(pos < r->fail){
+        return;
+    }
+    for(int i=0; i < r->expected_num; i++){
+        if(strcmp(r->expected[i], what)==0){
+            return;
+        }
+    }
+    if(r->expected_num < LREAD_EXPECTED_MAX){
+        r->expected[r->expected_num++] = what;
+    }
+}
+
+/* Returns the character at 'pos', or '\0' at the end of input (like mpc, an embedded '\0' also ends the input) */
+char lread_peek(lreader* r, long pos){
+    return pos < r->n ? r->s[pos] : '\0';
+}
+
+int lread_is_space(char c){
+    return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+}
+
+int lread_is_digit(char c){
+    return c >= '0' && c <= '9';
+}
+
+int lread_is_symbol(char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || lread_is_digit(c)
+        || (c != '\0' && strchr("_+-*/^%\\=<>!&", c));
+}
+
+/* Skips whitespace after a token */
+void lread_skip(lreader* r){
+    while(lread_is_space(lread_peek(r, r->pos))){
+        r->pos++;
+    }
+}
+
+/* Converts the digits of a number token to an lval, like 'lval_read_num' does with strtol. Any fractional part is ignored */
+lval* lread_num(const char* s, long n){
+    int neg = s[0] == '-';
+    unsigned long limit = neg ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+    unsigned long x = 0;
+
+    for(long i=neg; i<n && lread_is_digit(s[i]); i++){
+        unsigned long d = s[i] - '0';
+        if(x > (limit - d) / 10){
+            return lval_err("invalid number");
+        }
+        x = x*10 + d;
+    }
+
+    return lval_num(neg ? (long) (0 - x) : (long) x);
+}
+
+lval* lread_list(lreader* r, lval* x, char close);
+
+/* Reads one expression at the current position, or returns NULL if none starts here */
+lval* lread_expr(lreader* r){
+    long p = r->pos;
+    char c = lread_peek(r, p);
+
+    /* number : /-?[0-9]+((\.)[0-9]+)?/ */
+    long q = p;
+    if(c == '-'){
+        q++;
+    } else{
+        lread_expect(r, p, "'-'");
+    }
+    if(lread_is_digit(lread_peek(r, q))){
+        while(lread_is_digit(lread_peek(r, q))){
+            q++;
+        }
+        lread_expect(r, q, LREAD_DIGIT);
+        if(lread_peek(r, q) == '.' && lread_is_digit(lread_peek(r, q+1))){
+            q++;
+            while(lread_is_digit(lread_peek(r, q))){
+                q++;
+            }
+            lread_expect(r, q, LREAD_DIGIT);
+        } else if(lread_peek(r, q) == '.'){
+            lread_expect(r, q+1, LREAD_DIGITS);
+        } else{
+            lread_expect(r, q, "'.'");
+        }
+
+        r->pos = q;
+        lread_skip(r);
+        return lread_num(r->s + p, q - p);
+    }
+    lread_expect(r, q, LREAD_DIGITS);
+
+    /* symbol : /[a-zA-Z0-9_+\-*\/^%\\=<>!&]+/ */
+    if(lread_is_symbol(c)){
+        q = p;
+        while(lread_is_symbol(lread_peek(r, q))){
+            q++;
+        }
+        lread_expect(r, q, LREAD_SYMBOL);
+
+        r->pos = q;
+        lread_skip(r);
+        return lval_sym_n(r->s + p, q - p);
+    }
+    lread_expect(r, p, LREAD_SYMBOLS);
+
+    /* sexpr : '(' <expr>* ')' ; and qexpr : '{' <expr>* '}' ; */
+    if(c == '(' || c == '{'){
+        r->pos++;
+        lread_skip(r);
+        return c == '('
+            ? lread_list(r, lval_sexpr(), ')')
+            : lread_list(r, lval_qexpr(), '}');
+    }
+    lread_expect(r, p, "'('");
+    lread_expect(r, p, "'{'");
+
+    return NULL;
+}
+
+/* Reads expressions into 'x' until the closing bracket 'close', or until the end of input if 'close' is '\0'. Returns NULL on a syntax error */
+lval* lread_list(lreader* r, lval* x, char close){
+    while(1){
+        lval* y = lread_expr(r);
+        if(y){
+            lval_add(x, y);
+            continue;
+        }
+
+        /* A failed nested list has already recorded its own error */
+        if(r->failed){
+            break;
+        }
+
+        char c = lread_peek(r, r->pos);
+        if(close){
+            if(c == close){
+                r->pos++;
+                lread_skip(r);
+                return x;
+            }
+            lread_expect(r, r->pos, close == ')' ? "')'" : "'}'");
+            break;
+        }
+
+        /* lispy : /^/ <expr>* /$/ ; where '$' is an optional newline followed by the end of input */
+        lread_expect(r, r->pos, "newline");
+        if(c == '\0'){
+            return x;
+        }
+        lread_expect(r, r->pos, "end of input");
+        break;
+    }
+
+    r->failed = 1;
+    lval_del(x);
+    return NULL;
+}
+
+/* Formats the furthest failure of 'r' exactly as 'mpc_err_string' would */
+char* lread_error(lreader* r){
+    long row = 0;
+    long col = 0;
+    for(long i=0; i < r->fail; i++){
+        col++;
+        if(r->s[i] == '\n'){
+            row++;
+            col = 0;
+        }
+    }
+
+    char received[4] = { '\'', r->fail < r->size ? r->s[r->fail] : '\0', '\'', '\0' };
+    const char* at = received;
+    switch(received[1]){
+        case '\a': at = "bell"; break;
+        case '\b': at = "backspace"; break;
+        case '\f': at = "formfeed"; break;
+        case '\r': at = "carriage return"; break;
+        case '\v': at = "vertical tab"; break;
+        case '\0': at = "end of input"; break;
+        case '\n': at = "newline"; break;
+        case '\t': at = "tab"; break;
+        case ' ': at = "space"; break;
+    }
+
+    /* Size the message from its parts rather than guessing */
+    size_t len = strlen(r->filename) + strlen(at) + 128;
+    for(int i=0; i < r->expected_num; i++){
+        len += strlen(r->expected[i]) + 4;
+    }
+
+    char* err = malloc(len);
+    int pos = sprintf(err, "%s:%li:%li: error: expected ", r->filename, row+1, col+1);
+    for(int i=0; i < r->expected_num; i++){
+        char* sep = i == 0 ? "" : i == r->expected_num-1 ? " or " : ", ";
+        pos += sprintf(err + pos, "%s%s", sep, r->expected[i]);
+    }
+    sprintf(err + pos, " at %s\n", at);
+
+    return err;
+}
+
+/* Reads bytes 'start' to 'end' of 's' into an S-Expression.
+   'start' must be at the start of 's' or of a top-level form. Error positions are counted from the start of 's' */
+lval* lval_read_part(const char* filename, const char* s, long size, long start, long end, char** err){
+    lreader r;
+    r.filename = filename;
+    r.s = s;
+    r.n = end;
+    r.pos = start;
+    r.size = size;
+    r.failed = 0;
+    r.fail = -1;
+    r.expected_num = 0;
+
+    /* /^/ matches the start of input, then skips whitespace like any other token */
+    lread_skip(&r);
+
+    lval* x = lread_list(&r, lval_sexpr(), '\0');
+    if(!x){
+        *err = lread_error(&r);
+    }
+
+    return x;
+}
+
+/* Reads the 'n' bytes of 's' into an S-Expression, giving the same result as 'lval_read' on the AST of the 'lispy' rule.
+   On a syntax error returns NULL and sets 'err' to a message formatted like mpc's, which the caller must free */
+lval* lval_read_direct(const char* filename, const char* s, long n, char** err){
+    return lval_read_part(filename, s, n, 0, n, err);
+}
+
+/* Parses 'input' with the selected reader. Returns the program as an S-Expression, or prints the syntax error and returns NULL */
+lval* lispy_read(char* filename, char* input, mpc_parser_t* Lispy){
+    if(direct_reader){
+        char* err;
+        lval* x = lval_read_direct(filename, input, strlen(input), &err);
+        if(!x){
+            printf("%s", err);
+            free(err);
+        }
+        return x;
+    }
+
+    mpc_result_t r;
+    if(mpc_parse(filename, input, Lispy, &r)){
+        /* On success convert and delete the AST */
+        lval* x = lval_read(r.output);
+        mpc_ast_delete(r.output);
+        return x;
+    }
+
+    /* Otherwise print and delete the Error */
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+}
+
+/* Streaming */
+
+/* Bytes read from the stream at a time. The buffer only has to hold one top-level form plus one chunk */
+#define LSTREAM_CHUNK 65536
+
+/* Reads up to 'n' bytes of 'f', returning as soon as some are available rather than waiting for all 'n' like 'fread' */
+long lstream_fill(FILE* f, char* buf, long n){
+#ifdef _WIN32
+    return fread(buf, 1, n, f);
+#else
+    return read(fileno(f), buf, n);
+#endif
+}
+
+/* Reads and evaluates the first 'n' bytes of 'buf' as one top-level form, printing the result */
+void lstream_eval(lenv* e, char* filename, char* buf, long n, mpc_parser_t* Lispy){
+    char c = buf[n];
+    buf[n] = '\0';
+
+    lval* x = lispy_read(filename, buf, Lispy);
+    if(x){
+        x = lval_eval(e, x);
+        lval_println(x);
+        lval_del(x);
+    }
+
+    buf[n] = c;
+}
+
+/* Evaluates each top-level form of 'f' as soon as it is complete, instead of reading the whole stream first.
+   Lispy has no strings or comments, so a form ends when its brackets balance, or at whitespace after a bare atom */
+void lispy_stream(FILE* f, char* filename, lenv* e, mpc_parser_t* Lispy){
+    long cap = 2 * LSTREAM_CHUNK;
+    char* buf = malloc(cap + 1);
+    long len = 0;   /* bytes in 'buf' */
+    long scan = 0;  /* bytes of 'buf' already scanned */
+    long depth = 0; /* bracket depth at 'scan' */
+    int atom = 0;   /* whether the current form has started */
+
+    while(while_var == 1){
+        /* Make room for another chunk, only growing when a single form is larger than the buffer */
+        if(cap - len < LSTREAM_CHUNK){
+            cap *= 2;
+            buf = realloc(buf, cap + 1);
+        }
+
+        /* Show the results so far before possibly waiting on the stream */
+        fflush(stdout);
+
+        long got = lstream_fill(f, buf + len, LSTREAM_CHUNK);
+        if(got <= 0){
+            break;
+        }
+        len += got;
+
+        long start = 0;
+        for(; scan < len && while_var == 1; scan++){
+            char c = buf[scan];
+            int space = c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+
+            /* A bare atom ends at whitespace or at the next bracket */
+            if(atom && depth == 0 && (space || c == '(' || c == '{' || c == ')' || c == '}')){
+                lstream_eval(e, filename, buf + start, scan - start, Lispy);
+                start = scan;
+                atom = 0;
+                if(while_var != 1){
+                    break;
+                }
+            }
+
+            if(!atom){
+                if(space){
+                    start = scan + 1;
+                    continue;
+                }
+                atom = 1;
+            }
+
+            if(c == '(' || c == '{'){
+                depth++;
+            } else if(c == ')' || c == '}'){
+                /* A list ends when its brackets balance. A stray closing bracket is passed on so the reader reports it */
+                depth--;
+                if(depth <= 0){
+                    lstream_eval(e, filename, buf + start, scan + 1 - start, Lispy);
+                    start = scan + 1;
+                    depth = 0;
+                    atom = 0;
+                }
+            }
+        }
+
+        /* Keep only the unfinished form */
+        memmove(buf, buf + start, len - start);
+        len -= start;
+        scan -= start;
+    }
+
+    /* Whatever is left at the end of the stream is read as is, so an unclosed form reports its error */
+    if(while_var == 1 && atom){
+        lstream_eval(e, filename, buf, len, Lispy);
+    }
+
+    free(buf);
+}
+
+/* Parallel reading */
+
+/* Files smaller than this are read on one thread, since starting the threads would cost more than it saves */
+#define LPARSE_MIN (1 << 20)
+
+/* Threads take chunks from a shared counter, so a few chunks per thread even out the work */
+#define LPARSE_CHUNKS_PER_JOB 4
+
+typedef struct {
+    const char* filename;
+    const char* s;
+    long n;
+
+    /* Chunk 'i' is bytes 'bounds[i]' to 'bounds[i+1]' */
+    long* bounds;
+    int chunks;
+
+    /* Next chunk to read, shared between the threads */
+    int next;
+
+    /* What each chunk was read into, or its error */
+    lval** forests;
+    char** errs;
+} lparse;
+
+/* Splits the 'n' bytes of 's' into at most 'chunks' chunks of whole top-level forms and returns how many there are.
+   Chunks are cut just after whitespace at bracket depth 0, so no token or list is split and the reader never looks past a chunk */
+int lparse_split(const char* s, long n, long* bounds, int chunks){
+    int count = 0;
+    long depth = 0;
+    bounds[0] = 0;
+
+    for(long i=0; i < n-1 && count+1 < chunks; i++){
+        char c = s[i];
+        if(c == '(' || c == '{'){
+            depth++;
+        } else if(c == ')' || c == '}'){
+            depth--;
+        } else if(depth <= 0 && i >= n / chunks * (count+1) && lread_is_space(c) && !lread_is_space(s[i+1])){
+            bounds[++count] = i+1;
+        }
+    }
+
+    bounds[++count] = n;
+    return count;
+}
+
+void* lparse_worker(void* arg){
+    lparse* p = arg;
+
+    while(1){
+        int i = __sync_fetch_and_add(&p->next, 1);
+        if(i >= p->chunks){
+            break;
+        }
+
+        p->errs[i] = NULL;
+        p->forests[i] = lval_read_part(p->filename, p->s, p->n, p->bounds[i], p->bounds[i+1], &p->errs[i]);
+    }
+
+    return NULL;
+}
+
+/* Reads like 'lval_read_direct', but large inputs are split into chunks of top-level forms that are read on 'parse_jobs' threads.
+   The chunks' S-Expressions are joined in order. The first chunk that fails holds the first error in the file,
+   and since positions are counted from the start of 's' its line and column are the same as a single-threaded read */
+lval* lval_read_parallel(const char* filename, const char* s, long n, char** err){
+#ifdef _WIN32
+    return lval_read_direct(filename, s, n, err);
+#else
+    if(parse_jobs < 2 || n < LPARSE_MIN){
+        return lval_read_direct(filename, s, n, err);
+    }
+
+    lparse p;
+    p.filename = filename;
+    p.s = s;
+    p.n = n;
+    p.bounds = malloc(sizeof(long) * (parse_jobs * LPARSE_CHUNKS_PER_JOB + 1));
+    p.chunks = lparse_split(s, n, p.bounds, parse_jobs * LPARSE_CHUNKS_PER_JOB);
+    p.next = 0;
+    p.forests = malloc(sizeof(lval*) * p.chunks);
+    p.errs = malloc(sizeof(char*) * p.chunks);
+
+    /* The calling thread reads chunks too. If a thread can't be started the others just take more chunks */
+    pthread_t* threads = malloc(sizeof(pthread_t) * parse_jobs);
+    int started = 0;
+    for(int i=1; i < parse_jobs; i++){
+        if(pthread_create(&threads[started], NULL, lparse_worker, &p) == 0){
+            started++;
+        }
+    }
+    lparse_worker(&p);
+    for(int i=0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Stitch the chunks together, keeping only the first error */
+    lval* x = lval_sexpr();
+    *err = NULL;
+    for(int i=0; i < p.chunks; i++){
+        if(p.forests[i] && !*err){
+            x = lval_join(x, p.forests[i]);
+        } else if(p.forests[i]){
+            lval_del(p.forests[i]);
+        } else if(!*err){
+            *err = p.errs[i];
+        } else{
+            free(p.errs[i]);
+        }
+    }
+    if(*err){
+        lval_del(x);
+        x = NULL;
+    }
+
+    free(threads);
+    free(p.errs);
+    free(p.forests);
+    free(p.bounds);
+
+    return x;
+#endif
+}
+
+/* Loading */
+
+/* Maps the file 'filename' into memory and sets 'n' to its size. Returns NULL if it can't be read. Release with 'lload_unmap' */
+char* lload_map(char* filename, long* n){
+#ifdef _WIN32
+    /* No mmap, so read the whole file in one go instead */
+    FILE* f = fopen(filename, "rb");
+    if(!f){
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* s = malloc(*n + 1);
+    *n = fread(s, 1, *n, f);
+    fclose(f);
+    return s;
+#else
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)){
+        close(fd);
+        return NULL;
+    }
+
+    /* mmap can't map an empty file, but any non-NULL pointer will do for zero bytes */
+    *n = st.st_size;
+    char* s = *n ? mmap(NULL, *n, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if(s == MAP_FAILED){
+        return NULL;
+    }
+
+    posix_madvise(s, *n, POSIX_MADV_SEQUENTIAL);
+    return s;
+#endif
+}
+
+void lload_unmap(char* s, long n){
+#ifdef _WIN32
+    free(s);
+#else
+    if(n){
+        munmap(s, n);
+    }
+#endif
+}
+
+/* Reads the file 'filename' and evaluates each of its top-level forms in order, printing any errors.
+   Both readers parse straight out of the mapping, which is never copied or terminated */
+lval* lispy_load(lenv* e, char* filename){
+    long n;
+    char* s = lload_map(filename, &n);
+    if(!s){
+        return lval_err("Could not load file '%s'", filename);
+    }
+
+    lval* x;
+    if(direct_reader){
+        char* err;
+        x = lval_read_parallel(filename, s, n, &err);
+        if(!x){
+            x = lval_err("%s", err);
+            free(err);
+        }
+    } else{
+        mpc_result_t r;
+        if(mpc_nparse(filename, s, n, lispy_parser, &r)){
+            x = lval_read(r.output);
+            mpc_ast_delete(r.output);
+        } else{
+            char* err = mpc_err_string(r.error);
+            x = lval_err("%s", err);
+            free(err);
+            mpc_err_delete(r.error);
+        }
+    }
+    lload_unmap(s, n);
+
+    if(x->type == LVAL_ERR){
+        /* Syntax errors end in a newline which 'lval_println' already adds */
+        size_t len = strlen(x->err);
+        if(len && x->err[len-1] == '\n'){
+            x->err[len-1] = '\0';
+        }
+        return x;
+    }
+
+    /* Evaluate each form, taking them in place rather than popping from the front */
+    for(int i=0; i < x->count && while_var == 1; i++){
+        lval* y = lval_eval(e, x->cell[i]);
+        x->cell[i] = NULL;
+        if(y->type == LVAL_ERR){
+            lval_println(y);
+        }
+        lval_del(y);
+    }
+    for(int i=0; i < x->count; i++){
+        if(x->cell[i]){
+            lval_del(x->cell[i]);
+        }
+    }
+    x->count = 0;
+    lval_del(x);
+
+    return lval_sexpr();
+}
+
+/* Loads the file named by a symbol, e.g. (load {examples/fib}) loads examples/fib.lspy */
+lval* builtin_load(lenv* e, lval* a){
+    INCARGS(a, 1, "load");
+    INCTYPE(a, 0, LVAL_QEXPR, "load");
+    LASSERT(a, a->cell[0]->count==1 && a->cell[0]->cell[0]->type==LVAL_SYM, "Function 'load' passed invalid input");
+
+    char* name = a->cell[0]->cell[0]->sym;
+    char* filename = malloc(strlen(name) + 6);
+    sprintf(filename, "%s.lspy", name);
+
+    lval* x = lispy_load(e, filename);
+    free(filename);
+    lval_del(a);
+
+    return x;
+}
+
+int main(int argc, char** argv) {
+  
   /* Create Some Parsers */
   mpc_parser_t* Number   = mpc_new("number");
   mpc_parser_t* Symbol   = mpc_new("symbol");
@@ -851,8 +2650,42 @@ int main(int argc, char** argv) {
   mpc_parser_t* Expr     = mpc_new("expr");
   mpc_parser_t* Lispy    = mpc_new("lispy");
   
-  /* Define them */
-  mpca_lang(MPCA_LANG_DEFAULT,
+  /* Select the reader, and whether to stream forms from stdin instead of prompting */
+  int stream = 0;
+  const char* grammar_cache = NULL;
+  int files = 0;
+  for(int i=1; i < argc; i++){
+    if(strncmp(argv[i], "--", 2)!=0){
+        files++;
+    }
+    if(strcmp(argv[i], "--stream")==0){
+        stream = 1;
+    }
+    if(strcmp(argv[i], "--reader=direct")==0){
+        direct_reader = 1;
+    }
+    if(strcmp(argv[i], "--reader=mpc")==0){
+        direct_reader = 0;
+    }
+    if(strncmp(argv[i], "--jobs=", 7)==0){
+        char* end;
+        errno = 0;
+        long jobs = strtol(argv[i] + 7, &end, 10);
+        if(end == argv[i] + 7 || *end != '\0' || jobs < 1){
+            printf("Invalid --jobs value '%s', expected a number of threads of at least 1\n", argv[i] + 7);
+            mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+            return 1;
+        }
+        /* More threads than this only add startup cost, and huge counts would overflow the chunk arithmetic */
+        parse_jobs = errno == ERANGE || jobs > MAX_JOBS ? MAX_JOBS : (int) jobs;
+    }
+    if(strncmp(argv[i], "--grammar-cache=", 16)==0){
+        grammar_cache = argv[i] + 16;
+    }
+  }
+
+  /* Define them, from a saved copy of the grammar if given --grammar-cache=FILE */
+  const char* grammar =
     "                                                     \
       number   : /-?[0-9]+((\\.)[0-9]+)?/ ;               \
       symbol   : /[a-zA-Z0-9_+\\-*\\/^%\\\\=<>!&]+/ ;       \
@@ -860,14 +2693,45 @@ int main(int argc, char** argv) {
       qexpr    : '{' <expr>* '}' ;                        \
       expr     : <number> | <symbol> | <sexpr> | <qexpr> ;\
       lispy    : /^/ <expr>* /$/ ;                        \
-    ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    ";
+  if(grammar_cache){
+    mpca_lang_cache(MPCA_LANG_ARENA | MPCA_LANG_TAG_IDS | MPCA_LANG_LAZY_ERRORS, grammar_cache, grammar,
+      Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  } else{
+    mpca_lang(MPCA_LANG_ARENA | MPCA_LANG_TAG_IDS | MPCA_LANG_LAZY_ERRORS, grammar,
+      Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  }
+
+  tag_number = mpc_tag_id(Number);
+  tag_symbol = mpc_tag_id(Symbol);
+  tag_sexpr = mpc_tag_id(Sexpr);
+  tag_qexpr = mpc_tag_id(Qexpr);
+  tags_expr = MPC_TAG_BIT(tag_number) | MPC_TAG_BIT(tag_symbol) | MPC_TAG_BIT(tag_sexpr) | MPC_TAG_BIT(tag_qexpr);
   
-  puts("Lispy Version 0.0.0.0.11");
-  puts("Press Ctrl+c to Exit\n");
+  lispy_parser = Lispy;
 
   lenv* e = lenv_new();
   lenv_add_builtins(e);
+
+  /* Run any files given on the command line instead of prompting */
+  if(files){
+    for(int i=1; i < argc && while_var == 1; i++){
+        if(strncmp(argv[i], "--", 2)!=0){
+            lval* x = lispy_load(e, argv[i]);
+            if(x->type == LVAL_ERR){
+                lval_println(x);
+            }
+            lval_del(x);
+        }
+    }
+    while_var = 0;
+  } else if(stream){
+    lispy_stream(stdin, "<stdin>", e, Lispy);
+    while_var = 0;
+  } else{
+    puts("Lispy Version 0.0.0.0.11");
+    puts("Press Ctrl+c to Exit\n");
+  }
   
   while (while_var>0) {
   
@@ -876,21 +2740,15 @@ int main(int argc, char** argv) {
         add_history(input);
 
         /* Attempt to parse the user input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Lispy, &r)) {
-            /* On success print and delete the AST */
-            lval* x = lval_eval(e, lval_read(r.output));
-            if(strcmp(x->err, "Unbound symbol 'y'")==0){
+        lval* x = lispy_read("<stdin>", input, Lispy);
+        if(x){
+            x = lval_eval(e, x);
+            if(x->type == LVAL_ERR && strcmp(x->err, "Unbound symbol 'y'")==0){
                 while_var = 0;
             } else{
                 while_var = 1;
             }
             lval_del(x);
-            mpc_ast_delete(r.output);
-        } else {
-            /* Otherwise print and delete the Error */
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
         }
     
         free(input);
@@ -901,17 +2759,11 @@ int main(int argc, char** argv) {
         add_history(input);
         
         /* Attempt to parse the user input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Lispy, &r)) {
-            /* On success print and delete the AST */
-            lval* x = lval_eval(e, lval_read(r.output));
+        lval* x = lispy_read("<stdin>", input, Lispy);
+        if(x){
+            x = lval_eval(e, x);
             lval_println(x);
             lval_del(x);
-            mpc_ast_delete(r.output);
-        } else {
-            /* Otherwise print and delete the Error */
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
         }
         
         free(input);